@@ -0,0 +1,570 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+/* headless benchmark suite. Generates a set of canonical scenes and measures
+ * how many primary, shadow and reflection rays per second the tracer gets
+ * through on each, followed by microbenchmarks of the primitive and box
+ * tests and of shade(). Everything runs on the calling thread, so the
+ * numbers are comparable between machines with different core counts.
+ *
+ * Build from this directory with:
+ *
+ *   c++ -O2 -std=c++11 -pthread -I../src rtbench.cc ../src/arena.cc \
+ *       ../src/bbox.cc ../src/bvh.cc ../src/camera.cc ../src/light.cc \
+ *       ../src/object.cc ../src/mappedfile.cc ../src/plane.cc \
+ *       ../src/scene.cc ../src/scenecache.cc ../src/shade.cc \
+ *       ../src/sphere.cc ../src/sphereflake.cc ../src/stats.cc \
+ *       ../src/tilesched.cc ../src/timer.cc -o rtbench
+ *
+ * usage: rtbench [-size WxH] [-json file] [-nomicro] [-list] [scene ...]
+ *
+ * With no scene names all the scenes are run. -json writes the results to
+ * the file (or stdout for "-") for tracking regressions between releases.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "scene.h"
+#include "shade.h"
+#include "sphere.h"
+#include "plane.h"
+#include "sphereflake.h"
+#include "camera.h"
+#include "light.h"
+
+// minimum time spent on each measurement, repeated until it's reached
+#define MIN_BENCH_SEC	0.25
+
+struct SceneDesc {
+	const char *name;
+	int (*generate)(Scene *scn, int arg);	// returns the number of primitives
+	int arg;
+};
+
+struct SceneResult {
+	std::string name;
+	int num_prims;
+	int num_lights;
+	double build_msec;
+	long num_primary, num_shadow, num_reflection;
+	long num_occluded, num_reflected;	// shadow and reflection rays that hit something
+	double primary_sec, shadow_sec, reflection_sec;
+};
+
+struct MicroResult {
+	const char *name;
+	double nsec;	// per call
+	long num_hits;
+};
+
+// shade() works on the global scene, the microbenchmark sets it up
+Scene scene;
+
+static int gen_sflake(Scene *scn, int iter);
+static int gen_random(Scene *scn, int count);
+static int gen_lights(Scene *scn, int count);
+static int gen_planes(Scene *scn, int count);
+
+static const SceneDesc scenes[] = {
+	{"sflake_2", gen_sflake, 2},
+	{"sflake_4", gen_sflake, 4},
+	{"sflake_6", gen_sflake, 6},
+	{"random_1k", gen_random, 1000},
+	{"random_100k", gen_random, 100000},
+	{"random_1m", gen_random, 1000000},
+	{"lights_64", gen_lights, 64},
+	{"planes_16", gen_planes, 16}
+};
+#define NUM_SCENES	((int)(sizeof scenes / sizeof *scenes))
+
+static int width = 512, height = 512;
+
+static void run_scene(const SceneDesc &desc, SceneResult *res);
+static void run_micro(std::vector<MicroResult> *res);
+static bool write_json(FILE *fp, const std::vector<SceneResult> &sres, const std::vector<MicroResult> &mres);
+static void add_sphere(Scene *scn, const Vector3 &c, double rad, const Color &kd, double kr);
+static void add_plane(Scene *scn, const Vector3 &n, double dist, double kr);
+static void set_view(Scene *scn, const Vector3 &pos, const Vector3 &target, double fov);
+static double frand(double lo, double hi);
+static void seed(uint32_t s);
+static double mrays(long count, double sec);
+static double now_sec();
+
+int main(int argc, char **argv) {
+	const char *json_fname = 0;
+	bool micro = true;
+	std::vector<const SceneDesc*> run;
+
+	for (int i = 1; i < argc; i++) {
+		if (argv[i][0] == '-' && argv[i][1]) {
+			if (strcmp(argv[i], "-size") == 0) {
+				if (!argv[++i] || sscanf(argv[i], "%dx%d", &width, &height) < 2 ||
+						width < 1 || height < 1) {
+					fprintf(stderr, "-size should be followed by WxH\n");
+					return 1;
+				}
+			} else if (strcmp(argv[i], "-json") == 0) {
+				if (!(json_fname = argv[++i])) {
+					fprintf(stderr, "-json should be followed by a file name\n");
+					return 1;
+				}
+			} else if (strcmp(argv[i], "-nomicro") == 0) {
+				micro = false;
+			} else if (strcmp(argv[i], "-list") == 0) {
+				for (int j = 0; j < NUM_SCENES; j++) {
+					printf("%s\n", scenes[j].name);
+				}
+				return 0;
+			} else {
+				fprintf(stderr, "unknown option: %s\n", argv[i]);
+				return 1;
+			}
+		} else {
+			int j;
+			for (j = 0; j < NUM_SCENES; j++) {
+				if (strcmp(argv[i], scenes[j].name) == 0) {
+					run.push_back(scenes + j);
+					break;
+				}
+			}
+			if (j == NUM_SCENES) {
+				fprintf(stderr, "unknown scene: %s (see -list)\n", argv[i]);
+				return 1;
+			}
+		}
+	}
+
+	if (run.empty()) {
+		for (int i = 0; i < NUM_SCENES; i++) {
+			run.push_back(scenes + i);
+		}
+	}
+
+	std::vector<SceneResult> sres(run.size());
+	for (size_t i = 0; i < run.size(); i++) {
+		run_scene(*run[i], &sres[i]);
+
+		const SceneResult &r = sres[i];
+		printf("%-12s %8d prims %3d lights  build %8.1f ms  primary %7.2f  shadow %7.2f  reflection %7.2f Mrays/s\n",
+				r.name.c_str(), r.num_prims, r.num_lights, r.build_msec,
+				mrays(r.num_primary, r.primary_sec), mrays(r.num_shadow, r.shadow_sec),
+				mrays(r.num_reflection, r.reflection_sec));
+	}
+
+	std::vector<MicroResult> mres;
+	if (micro) {
+		run_micro(&mres);
+
+		for (size_t i = 0; i < mres.size(); i++) {
+			printf("%-20s %8.2f ns/call (%ld hits)\n", mres[i].name, mres[i].nsec, mres[i].num_hits);
+		}
+	}
+
+	if (json_fname) {
+		FILE *fp = strcmp(json_fname, "-") == 0 ? stdout : fopen(json_fname, "w");
+		if (!fp) {
+			perror(json_fname);
+			return 1;
+		}
+		bool res = write_json(fp, sres, mres);
+		if (fp != stdout) {
+			fclose(fp);
+		}
+		if (!res) {
+			fprintf(stderr, "failed to write: %s\n", json_fname);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* the shadow and reflection rays are spawned from the primary hits of the
+ * last primary pass, the same way shade() spawns them, but every hit gets a
+ * reflection ray regardless of its material.
+ */
+static void run_scene(const SceneDesc &desc, SceneResult *res) {
+	Scene *scn = new Scene;
+
+	seed(1);
+	res->num_prims = desc.generate(scn, desc.arg);
+
+	Camera *cam = scn->get_camera();
+	cam->set_image_size(width, height);
+
+	double start = now_sec();
+	scn->build_bbtree();
+	res->build_msec = (now_sec() - start) * 1000.0;
+
+	res->name = desc.name;
+	res->num_lights = (int)scn->lights.size();
+
+	// primary rays, in packets like the renderer traces them
+	std::vector<IntInfo> hits((size_t)width * height);
+	std::vector<char> hit_mask((size_t)width * height);
+	Ray rays[PACKET_SIZE * PACKET_SIZE];
+	IntInfo pinf[PACKET_SIZE * PACKET_SIZE];
+	bool phit[PACKET_SIZE * PACKET_SIZE];
+
+	res->num_primary = 0;
+	start = now_sec();
+	do {
+		for (int y = 0; y < height; y += PACKET_SIZE) {
+			int h = height - y < PACKET_SIZE ? height - y : PACKET_SIZE;
+
+			for (int x = 0; x < width; x += PACKET_SIZE) {
+				int w = width - x < PACKET_SIZE ? width - x : PACKET_SIZE;
+
+				cam->get_primary_rays(x, y, w, h, rays);
+				scn->intersection(rays, w * h, pinf, phit);
+
+				for (int i = 0; i < h; i++) {
+					for (int j = 0; j < w; j++) {
+						size_t idx = (size_t)(y + i) * width + x + j;
+						hits[idx] = pinf[i * w + j];
+						hit_mask[idx] = phit[i * w + j];
+					}
+				}
+			}
+		}
+		res->num_primary += (long)width * height;
+		res->primary_sec = now_sec() - start;
+	} while (res->primary_sec < MIN_BENCH_SEC);
+
+	// shadow rays, from every primary hit to every light
+	res->num_occluded = res->num_shadow = 0;
+	start = now_sec();
+	do {
+		for (size_t i = 0; i < hits.size(); i++) {
+			if (!hit_mask[i]) continue;
+
+			for (size_t j = 0; j < scn->lights.size(); j++) {
+				Vector3 p = hits[i].i_point;
+				Vector3 sorg = secondary_origin(p, hits[i].normal, scn->lights[j]->position - p);
+				Ray sray(sorg, scn->lights[j]->position - sorg, 0);
+
+				res->num_occluded += scn->occluded(sray);
+				res->num_shadow++;
+			}
+		}
+		res->shadow_sec = now_sec() - start;
+	} while (res->num_shadow && res->shadow_sec < MIN_BENCH_SEC);
+
+	// one bounce of reflection rays, made up front so that only tracing them is timed
+	std::vector<Ray> refrays;
+	for (size_t i = 0; i < hits.size(); i++) {
+		if (!hit_mask[i]) continue;
+
+		size_t x = i % width, y = i / width;
+		Ray pray = cam->get_primary_ray(x, y);
+		Vector3 rdir = reflect(-pray.dir, hits[i].normal);
+		refrays.push_back(Ray(secondary_origin(hits[i].i_point, hits[i].normal, rdir), rdir, 0));
+	}
+
+	res->num_reflected = res->num_reflection = 0;
+	start = now_sec();
+	do {
+		for (size_t i = 0; i < refrays.size(); i++) {
+			IntInfo inf;
+			res->num_reflected += scn->intersection(refrays[i], &inf);
+			res->num_reflection++;
+		}
+		res->reflection_sec = now_sec() - start;
+	} while (res->num_reflection && res->reflection_sec < MIN_BENCH_SEC);
+
+	delete scn;
+	delete cam;
+}
+
+static void run_micro(std::vector<MicroResult> *res) {
+	static const int num_objects = 64;
+	static const int num_rays = 4096;
+
+	seed(2);
+
+	std::vector<Ray> rays(num_rays);
+	for (int i = 0; i < num_rays; i++) {
+		Vector3 origin(frand(-5, 5), frand(-5, 5), -30.0);
+		Vector3 target(frand(-10, 10), frand(-10, 10), frand(-10, 10));
+		rays[i].set(origin, normalize(target - origin) * RAY_MAG);
+	}
+
+	std::vector<Sphere*> spheres;
+	std::vector<Plane> planes;
+	std::vector<BBox> boxes;
+
+	for (int i = 0; i < num_objects; i++) {
+		Vector3 c(frand(-10, 10), frand(-10, 10), frand(-10, 10));
+		Sphere *sph = scene.add_sphere(c, frand(0.5, 2.0), -1);
+		sph->calc_bbox();
+		spheres.push_back(sph);
+		boxes.push_back(sph->get_bbox());
+
+		Vector3 n(frand(-1, 1), frand(-1, 1), frand(-1, 1));
+		planes.push_back(Plane(n, frand(-10, 10)));
+	}
+
+	MicroResult mr;
+	IntInfo inf;
+	double start;
+	long iter, num_tests;
+
+	mr.name = "sphere_intersection";
+	mr.num_hits = iter = 0;
+	start = now_sec();
+	do {
+		for (int i = 0; i < num_rays; i++) {
+			for (int j = 0; j < num_objects; j++) {
+				mr.num_hits += spheres[j]->intersection(rays[i], &inf);
+			}
+		}
+		iter++;
+	} while (now_sec() - start < MIN_BENCH_SEC);
+	num_tests = iter * num_rays * num_objects;
+	mr.nsec = (now_sec() - start) * 1e9 / num_tests;
+	res->push_back(mr);
+
+	mr.name = "plane_intersection";
+	mr.num_hits = iter = 0;
+	start = now_sec();
+	do {
+		for (int i = 0; i < num_rays; i++) {
+			for (int j = 0; j < num_objects; j++) {
+				mr.num_hits += planes[j].intersection(rays[i], &inf);
+			}
+		}
+		iter++;
+	} while (now_sec() - start < MIN_BENCH_SEC);
+	num_tests = iter * num_rays * num_objects;
+	mr.nsec = (now_sec() - start) * 1e9 / num_tests;
+	res->push_back(mr);
+
+	mr.name = "bbox_intersection";
+	mr.num_hits = iter = 0;
+	start = now_sec();
+	do {
+		for (int i = 0; i < num_rays; i++) {
+			for (int j = 0; j < num_objects; j++) {
+				mr.num_hits += boxes[j].intersection(rays[i]);
+			}
+		}
+		iter++;
+	} while (now_sec() - start < MIN_BENCH_SEC);
+	num_tests = iter * num_rays * num_objects;
+	mr.nsec = (now_sec() - start) * 1e9 / num_tests;
+	res->push_back(mr);
+
+	// shade() on the closest hit of every ray, the spheres are in the global scene already
+	for (int i = 0; i < num_objects; i++) {
+		Material mat;
+		mat.kd = Color(frand(0, 1), frand(0, 1), frand(0, 1));
+		mat.ks = Color(0.5, 0.5, 0.5);
+		mat.specexp = 60.0;
+		mat.kr = i & 1 ? 0.3 : 0.0;
+		spheres[i]->set_material(scene.add_material(mat));
+	}
+	scene.lights.push_back(new Light(Vector3(-20, 30, -20), Color(0.7, 0.7, 0.7)));
+	scene.lights.push_back(new Light(Vector3(20, 30, -10), Color(0.4, 0.4, 0.4)));
+	scene.build_bbtree();
+
+	std::vector<IntInfo> hits;
+	std::vector<Ray> hit_rays;
+	for (int i = 0; i < num_rays; i++) {
+		if (scene.intersection(rays[i], &inf)) {
+			hits.push_back(inf);
+			hit_rays.push_back(rays[i]);
+		}
+	}
+
+	double sum = 0.0;
+	mr.name = "shade";
+	mr.num_hits = (long)hits.size();
+	iter = 0;
+	start = now_sec();
+	do {
+		for (size_t i = 0; i < hits.size(); i++) {
+			Color c = shade(hit_rays[i], &hits[i], MAX_DEPTH);
+			sum += c.x + c.y + c.z;
+		}
+		iter++;
+	} while (!hits.empty() && now_sec() - start < MIN_BENCH_SEC);
+	num_tests = iter * (long)hits.size();
+	mr.nsec = num_tests ? (now_sec() - start) * 1e9 / num_tests : 0.0;
+	if (sum < 0.0) {	// never true, keeps the shading from being optimized away
+		mr.num_hits = 0;
+	}
+	res->push_back(mr);
+}
+
+static bool write_json(FILE *fp, const std::vector<SceneResult> &sres, const std::vector<MicroResult> &mres) {
+	fprintf(fp, "{\n\t\"width\": %d,\n\t\"height\": %d,\n\t\"scenes\": [", width, height);
+	for (size_t i = 0; i < sres.size(); i++) {
+		const SceneResult &r = sres[i];
+
+		fprintf(fp, "%s\n\t\t{\n", i ? "," : "");
+		fprintf(fp, "\t\t\t\"name\": \"%s\",\n", r.name.c_str());
+		fprintf(fp, "\t\t\t\"primitives\": %d,\n", r.num_prims);
+		fprintf(fp, "\t\t\t\"lights\": %d,\n", r.num_lights);
+		fprintf(fp, "\t\t\t\"build_msec\": %.3f,\n", r.build_msec);
+		fprintf(fp, "\t\t\t\"primary_rays\": %ld,\n", r.num_primary);
+		fprintf(fp, "\t\t\t\"primary_mrays_per_sec\": %.4f,\n", mrays(r.num_primary, r.primary_sec));
+		fprintf(fp, "\t\t\t\"shadow_rays\": %ld,\n", r.num_shadow);
+		fprintf(fp, "\t\t\t\"shadow_mrays_per_sec\": %.4f,\n", mrays(r.num_shadow, r.shadow_sec));
+		fprintf(fp, "\t\t\t\"shadow_occluded\": %ld,\n", r.num_occluded);
+		fprintf(fp, "\t\t\t\"reflection_rays\": %ld,\n", r.num_reflection);
+		fprintf(fp, "\t\t\t\"reflection_mrays_per_sec\": %.4f,\n", mrays(r.num_reflection, r.reflection_sec));
+		fprintf(fp, "\t\t\t\"reflection_hits\": %ld\n", r.num_reflected);
+		fprintf(fp, "\t\t}");
+	}
+	fprintf(fp, "\n\t],\n\t\"micro\": [");
+	for (size_t i = 0; i < mres.size(); i++) {
+		fprintf(fp, "%s\n\t\t{\"name\": \"%s\", \"nsec_per_call\": %.3f, \"hits\": %ld}",
+				i ? "," : "", mres[i].name, mres[i].nsec, mres[i].num_hits);
+	}
+	fprintf(fp, "\n\t]\n}\n");
+
+	fflush(fp);
+	return !ferror(fp);
+}
+
+// a plane below a single sphereflake of iter levels, like the usual test scene
+static int gen_sflake(Scene *scn, int iter) {
+	set_view(scn, Vector3(0, 4, -12), Vector3(0, 0, 0), 50.0);
+	scn->lights.push_back(new Light(Vector3(-10, 10, -10), Color(0.7, 0.7, 0.7)));
+	scn->lights.push_back(new Light(Vector3(10, 8, -6), Color(0.4, 0.4, 0.5)));
+	add_plane(scn, Vector3(0, 1, 0), -2.0, 0.3);
+
+	Material mat;
+	mat.kd = Color(0.3, 0.3, 0.9);
+	mat.ks = Color(0.9, 0.9, 0.9);
+	mat.specexp = 80.0;
+	mat.kr = 0.6;
+	scn->add_sphereflake(Vector3(0, 0, 0), 1.0, iter, scn->add_material(mat));
+
+	// the plane and 6^i spheres on level i of the flake
+	int count = 1;
+	for (int i = 0, level = 1; i < iter; i++, level *= 6) {
+		count += level;
+	}
+	return count;
+}
+
+// count random spheres in a 120 x 50 x 120 field, seen from above
+static int gen_random(Scene *scn, int count) {
+	set_view(scn, Vector3(0, 30, -120), Vector3(0, 0, 0), 45.0);
+	scn->lights.push_back(new Light(Vector3(-50, 80, -60), Color(0.8, 0.8, 0.8)));
+
+	for (int i = 0; i < count; i++) {
+		Vector3 c(frand(-60, 60), frand(-10, 40), frand(-60, 60));
+		Color kd(frand(0, 1), frand(0, 1), frand(0, 1));
+		add_sphere(scn, c, frand(0.3, 1.5), kd, i % 3 ? 0.0 : 0.4);
+	}
+	return count;
+}
+
+// 1000 random spheres lit by count lights scattered above them
+static int gen_lights(Scene *scn, int count) {
+	int num_prims = gen_random(scn, 1000);
+	delete scn->lights[0];
+	scn->lights.clear();
+
+	double intensity = 1.0 / count;
+	for (int i = 0; i < count; i++) {
+		Vector3 pos(frand(-80, 80), frand(50, 100), frand(-80, 80));
+		scn->lights.push_back(new Light(pos, Color(intensity, intensity, intensity)));
+	}
+	return num_prims;
+}
+
+// count planes around and across a small field of 100 spheres
+static int gen_planes(Scene *scn, int count) {
+	set_view(scn, Vector3(0, 5, -40), Vector3(0, 0, 0), 60.0);
+	scn->lights.push_back(new Light(Vector3(-10, 20, -20), Color(0.6, 0.6, 0.6)));
+	scn->lights.push_back(new Light(Vector3(15, 10, -10), Color(0.4, 0.4, 0.4)));
+
+	for (int i = 0; i < count; i++) {
+		Vector3 n(frand(-1, 1), frand(-1, 1), frand(-1, 1));
+		add_plane(scn, n, -frand(50, 100), i & 1 ? 0.2 : 0.0);
+	}
+
+	for (int i = 0; i < 100; i++) {
+		Vector3 c(frand(-15, 15), frand(-5, 10), frand(-15, 15));
+		Color kd(frand(0, 1), frand(0, 1), frand(0, 1));
+		add_sphere(scn, c, frand(0.5, 2.0), kd, i & 1 ? 0.5 : 0.0);
+	}
+	return count + 100;
+}
+
+static void add_sphere(Scene *scn, const Vector3 &c, double rad, const Color &kd, double kr) {
+	Material mat;
+	mat.kd = kd;
+	mat.ks = Color(0.5, 0.5, 0.5);
+	mat.specexp = 40.0;
+	mat.kr = kr;
+	scn->add_sphere(c, rad, scn->add_material(mat));
+}
+
+static void add_plane(Scene *scn, const Vector3 &n, double dist, double kr) {
+	Material mat;
+	mat.kd = Color(0.4, 0.4, 0.4);
+	mat.ks = Color(0.3, 0.3, 0.3);
+	mat.specexp = 30.0;
+	mat.kr = kr;
+	scn->add_plane(n, dist, scn->add_material(mat));
+}
+
+static void set_view(Scene *scn, const Vector3 &pos, const Vector3 &target, double fov) {
+	Camera *cam = new Camera(pos, target);
+	cam->set_fov(M_PI * fov / 180.0);
+	scn->set_camera(cam);
+}
+
+/* the scenes have to be the same everywhere for the numbers to mean
+ * anything, so they don't use rand()
+ */
+static uint32_t rng_state;
+
+static void seed(uint32_t s) {
+	rng_state = s;
+}
+
+static double frand(double lo, double hi) {
+	// xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return lo + (hi - lo) * (rng_state / 4294967296.0);
+}
+
+static double mrays(long count, double sec) {
+	return sec > 0.0 ? count / sec * 1e-6 : 0.0;
+}
+
+static double now_sec() {
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,78 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <stdlib.h>
+#include "arena.h"
+
+Arena::Arena() {
+	next = 0;
+	left = 0;
+}
+
+Arena::~Arena() {
+	clear();
+}
+
+void *Arena::alloc(size_t size, size_t align) {
+	size_t pad = (align - (size_t)next % align) % align;
+
+	if (pad + size > left) {
+		// anything that wouldn't leave room for much else gets a block of its own
+		size_t block_size = size + align > ARENA_BLOCK_SIZE / 4 ? size + align : ARENA_BLOCK_SIZE;
+
+		char *block = (char*)malloc(block_size);
+		if (!block) {
+			throw std::bad_alloc();
+		}
+		blocks.push_back(block);
+
+		if (block_size != ARENA_BLOCK_SIZE) {
+			size_t bpad = (align - (size_t)block % align) % align;
+			return block + bpad;
+		}
+
+		next = block;
+		left = block_size;
+		pad = (align - (size_t)next % align) % align;
+	}
+
+	void *res = next + pad;
+	next += pad + size;
+	left -= pad + size;
+	return res;
+}
+
+void Arena::take(Arena *arena) {
+	blocks.insert(blocks.end(), arena->blocks.begin(), arena->blocks.end());
+
+	arena->blocks.clear();
+	arena->next = 0;
+	arena->left = 0;
+}
+
+void Arena::clear() {
+	for (size_t i = 0; i < blocks.size(); i++) {
+		free(blocks[i]);
+	}
+	blocks.clear();
+	next = 0;
+	left = 0;
+}
@@ -0,0 +1,66 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <vector>
+
+// size of the blocks arenas get their memory in
+#define ARENA_BLOCK_SIZE	(1 << 20)
+
+/* allocator for things that live as long as the scene, handing out memory
+ * from big blocks one after the other. Nothing is freed on its own, the
+ * blocks all go at once when the arena does, without running destructors,
+ * so whatever is created in an arena must not need them.
+ */
+class Arena {
+private:
+	std::vector<char*> blocks;
+	char *next;
+	size_t left;
+
+public:
+	Arena();
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena &operator =(const Arena&) = delete;
+
+	void *alloc(size_t size, size_t align);
+
+	template <typename T, typename... Args>
+	T *create(Args&&... args) {
+		return new(alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	/* takes over all the memory of arena, which is left empty. The blocks
+	 * this arena was filling stay where they are.
+	 */
+	void take(Arena *arena);
+
+	void clear();
+};
+
+#endif
@@ -22,12 +22,8 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #ifndef BBOX_H_
 #define BBOX_H_
 
-#include <vector>
 #include "vector.h"
 #include "ray.h"
-#include "intinfo.h"
-
-class Object;
 
 class BBox {
 public:
@@ -35,22 +31,16 @@ public:
 
 	BBox();
 	BBox(const Vector3 &min, const Vector3 &max);
-	
-	bool intersection(const Ray &ray) const;
-};
 
-class BBoxNode {
-private:
-	BBox bbox;
-	std::vector<BBoxNode*> children;
-	std::vector<Object*> objects;
-public:
-	BBoxNode(const BBox &bbox);
-	~BBoxNode();
+	// makes the box empty, ready to be grown with include
+	void reset();
+	void include(const Vector3 &p);
+	void include(const BBox &box);
+
+	Vector3 center() const;
+	double surface_area() const;
 	
-	bool intersection(const Ray &ray, IntInfo* inf) const;
-	void add_child(BBoxNode* node);
-	void add_object(Object* obj);
+	bool intersection(const Ray &ray) const;
 };
 
 #endif
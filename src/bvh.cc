@@ -0,0 +1,1001 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits>
+#include "bvh.h"
+#include "config.h"
+#include "object.h"
+#include "simd.h"
+#include "stats.h"
+
+// relative costs of visiting a node and intersecting an object
+#define TRAV_COST	0.125
+#define ISECT_COST	1.0
+
+/* past this depth the builder falls back to median splits, which can't
+ * go more than 32 levels deeper, so the traversal stack never overflows
+ */
+#define SAH_MAX_DEPTH	(BVH_MAX_DEPTH - 32)
+
+// every node pushes at most BVH_WIDTH - 1 more entries than it pops
+#define STACK_SIZE	(BVH_MAX_DEPTH * BVH_WIDTH)
+
+// node of the intermediate binary tree, which gets collapsed to BVHNodes
+struct BuildNode {
+	BBox bbox;
+	int offset;		// second child, or first primitive of leaves
+	int count;		// 0 for inner nodes
+};
+
+// index refers to a sphere if it's less than the number of spheres, else to an object
+struct BuildPrim {
+	BBox bbox;
+	Vector3 center;
+	int index;
+};
+
+struct Bin {
+	BBox bbox;
+	int count;
+};
+
+struct BuildData {
+	std::vector<BuildPrim> prims;
+	std::vector<BuildNode> bin;
+
+	std::vector<BVHSphere> spheres;
+	std::vector<const Object*> objects;
+
+	std::vector<BVHNode> nodes;
+	std::vector<SpherePack> packs;
+	std::vector<const Object*> leaf_objects;	// starts with the owners of the spheres
+
+	BVHStats *stats;
+};
+
+// a node to visit, or the leaf in the given slot of a node
+struct StackEntry {
+	int node;
+	int slot;	// -1 for nodes
+	scalar_t t;
+};
+
+// same for packets, with the rays of the packet that still need it
+struct PacketEntry {
+	int node;
+	int slot;
+	uint32_t active;
+	scalar_t t;
+};
+
+// everything about the ray that the node and sphere tests need
+struct RayData {
+	Pack4 origin[3];
+	Pack4 dir[3];
+	Pack4 invdir[3];
+	Pack4 far_invdir[3];	// invdir rounded up, for the far sides of the slabs
+	int dir_neg[3];
+	Pack4 tmin, tmax;
+	Pack4 a, inv_a;
+};
+
+/* closest hit found so far along a ray. Sphere hits only get their hit
+ * point and normal calculated at the end, generic objects fill in isect.
+ */
+struct HitData {
+	IntInfo isect;
+	scalar_t maxt;
+	const SpherePack *pack;
+	int lane;
+};
+
+static int build_node(BuildData *bd, int start, int count, int depth);
+static int collapse(BuildData *bd, int idx, int depth);
+static void make_leaf(BuildData *bd, const BuildNode &leaf, BVHNode *node, int slot);
+static int find_split(BuildPrim *prims, int count, const BBox &bounds, const BBox &cbounds);
+static int get_bin(const Vector3 &c, int axis, double cmin, double scale);
+static double get_axis(const Vector3 &v, int axis);
+static void *alloc_aligned(size_t size, void **mem);
+static inline void setup_ray(const Ray &ray, RayData *rd, HitData *hit);
+static inline bool finish_ray(const Ray &ray, const HitData &hit, IntInfo *inf);
+static inline int node_intersection(const BVHNode *node, const RayData &rd, scalar_t maxt, scalar_t *tnear);
+static inline int pack_intersection(const SpherePack *pack, const RayData &rd, scalar_t maxt, scalar_t *t);
+static inline void leaf_intersection(const BVHNode *node, int slot, const SpherePack *packs,
+		const Object * const *prims, const Ray &ray, const RayData &rd, HitData *hit);
+static inline bool pack_occluded(const SpherePack *pack, const RayData &rd);
+static inline bool leaf_occluded(const BVHNode *node, int slot, const SpherePack *packs,
+		const Object * const *prims, const Ray &ray, const RayData &rd);
+
+BVH::BVH() {
+	nodes = 0;
+	num_nodes = 0;
+	packs = 0;
+	num_packs = 0;
+	node_mem = pack_mem = 0;
+}
+
+BVH::~BVH() {
+	free(node_mem);
+	free(pack_mem);
+}
+
+void BVH::build(Object * const *objects, int num_objects, BVHStats *stats) {
+	BuildData bd;
+	BVHStats tmp;
+
+	bd.stats = stats ? stats : &tmp;
+	bd.stats->num_nodes = bd.stats->num_leaves = bd.stats->max_depth = 0;
+
+	free(node_mem);
+	free(pack_mem);
+	node_mem = pack_mem = 0;
+	nodes = 0;
+	packs = 0;
+	num_nodes = num_packs = 0;
+	prims.clear();
+
+	for (int i = 0; i < num_objects; i++) {
+		size_t first = bd.spheres.size();
+
+		if (!objects[i]->get_spheres(&bd.spheres)) {
+			bd.objects.push_back(objects[i]);
+			continue;
+		}
+
+		int owner = (int)bd.leaf_objects.size();
+		bd.leaf_objects.push_back(objects[i]);
+		for (size_t j = first; j < bd.spheres.size(); j++) {
+			bd.spheres[j].owner = owner;
+		}
+	}
+
+	int num_spheres = (int)bd.spheres.size();
+	int num_prims = num_spheres + (int)bd.objects.size();
+	bd.stats->num_spheres = num_spheres;
+
+	if (!num_prims) {
+		prims.swap(bd.leaf_objects);
+		return;
+	}
+
+	bd.prims.resize(num_prims);
+	for (int i = 0; i < num_prims; i++) {
+		BuildPrim *p = &bd.prims[i];
+
+		if (i < num_spheres) {
+			const BVHSphere &sph = bd.spheres[i];
+			Vector3 r(sph.radius, sph.radius, sph.radius);
+			p->bbox = BBox(sph.center - r, sph.center + r);
+		} else {
+			p->bbox = bd.objects[i - num_spheres]->get_bbox();
+		}
+		p->center = p->bbox.center();
+		p->index = i;
+	}
+
+	bd.bin.reserve(2 * num_prims);
+	build_node(&bd, 0, num_prims, 0);
+
+	bd.nodes.reserve(bd.bin.size() / 2 + 1);
+	collapse(&bd, 0, 0);
+
+	// copy the nodes and packs to single cache line aligned blocks
+	num_nodes = (int)bd.nodes.size();
+	BVHNode *node_buf = (BVHNode*)alloc_aligned(num_nodes * sizeof *nodes, &node_mem);
+	for (int i = 0; i < num_nodes; i++) {
+		node_buf[i] = bd.nodes[i];
+	}
+	nodes = node_buf;
+
+	num_packs = (int)bd.packs.size();
+	if (num_packs) {
+		SpherePack *pack_buf = (SpherePack*)alloc_aligned(num_packs * sizeof *packs, &pack_mem);
+		for (int i = 0; i < num_packs; i++) {
+			pack_buf[i] = bd.packs[i];
+		}
+		packs = pack_buf;
+	}
+
+	prims.swap(bd.leaf_objects);
+}
+
+void BVH::set_data(const BVHNode *nodes, int num_nodes, const SpherePack *packs, int num_packs,
+		const Object * const *objects, int num_objects) {
+	free(node_mem);
+	free(pack_mem);
+	node_mem = pack_mem = 0;
+
+	this->nodes = nodes;
+	this->num_nodes = num_nodes;
+	this->packs = packs;
+	this->num_packs = num_packs;
+	prims.assign(objects, objects + num_objects);
+}
+
+bool BVH::intersection(const Ray &ray, IntInfo *inf) const {
+	if (!num_nodes) {
+		return false;
+	}
+
+	RayData rd;
+	HitData hit;
+	setup_ray(ray, &rd, &hit);
+
+	StackEntry stack[STACK_SIZE];
+	int top = 0;
+
+	stack[top].node = 0;
+	stack[top].slot = -1;
+	stack[top++].t = 0.0;
+
+	while (top) {
+		StackEntry cur = stack[--top];
+
+		// something closer was found since this was pushed
+		if (cur.t > hit.maxt) {
+			continue;
+		}
+
+		const BVHNode *node = nodes + cur.node;
+
+		if (cur.slot >= 0) {
+			leaf_intersection(node, cur.slot, packs, prims.data(), ray, rd, &hit);
+			continue;
+		}
+
+		alignas(32) scalar_t tnear[BVH_WIDTH];
+		int mask = node_intersection(node, rd, hit.maxt, tnear);
+		if (!mask) {
+			continue;
+		}
+
+		/* push the children that got hit far to near, so that the nearest
+		 * one is visited first and can let us skip the rest
+		 */
+		StackEntry hits[BVH_WIDTH];
+		int num_hits = 0;
+
+		for (int i = 0; i < BVH_WIDTH; i++) {
+			if (!(mask & (1 << i))) {
+				continue;
+			}
+
+			int j = num_hits++;
+			while (j > 0 && hits[j - 1].t < tnear[i]) {
+				hits[j] = hits[j - 1];
+				j--;
+			}
+
+			if (node->num_packs[i] || node->num_objects[i]) {
+				hits[j].node = cur.node;
+				hits[j].slot = i;
+			} else {
+				hits[j].node = node->child[i];
+				hits[j].slot = -1;
+			}
+			hits[j].t = tnear[i];
+		}
+
+		for (int i = 0; i < num_hits; i++) {
+			stack[top++] = hits[i];
+		}
+	}
+
+	return finish_ray(ray, hit, inf);
+}
+
+void BVH::intersection(const Ray *rays, int num_rays, IntInfo *inf, bool *hits) const {
+	// bigger packets go through in pieces that fit the arrays and the ray masks below
+	while (num_rays > BVH_MAX_PACKET) {
+		intersection(rays, BVH_MAX_PACKET, inf, hits);
+		rays += BVH_MAX_PACKET;
+		inf += BVH_MAX_PACKET;
+		hits += BVH_MAX_PACKET;
+		num_rays -= BVH_MAX_PACKET;
+	}
+
+	if (!num_nodes) {
+		for (int i = 0; i < num_rays; i++) {
+			hits[i] = false;
+		}
+		return;
+	}
+
+	RayData rd[BVH_MAX_PACKET];
+	HitData hit[BVH_MAX_PACKET];
+
+	bool coherent = true;
+	for (int i = 0; i < num_rays; i++) {
+		setup_ray(rays[i], rd + i, hit + i);
+
+		for (int j = 0; j < 3; j++) {
+			if (rd[i].dir_neg[j] != rd[0].dir_neg[j]) {
+				coherent = false;
+			}
+		}
+	}
+
+	/* the packet visits the children in the order that suits its first
+	 * ray, which is only right for the rest if they all point the same way.
+	 */
+	if (!coherent) {
+		for (int i = 0; i < num_rays; i++) {
+			hits[i] = intersection(rays[i], inf + i);
+		}
+		return;
+	}
+
+	PacketEntry stack[STACK_SIZE];
+	int top = 0;
+
+	stack[top].node = 0;
+	stack[top].slot = -1;
+	stack[top].active = num_rays == 32 ? 0xffffffff : (1u << num_rays) - 1;
+	stack[top++].t = 0.0;
+
+	while (top) {
+		PacketEntry cur = stack[--top];
+
+		// skip it if all the rays that wanted it found something closer since
+		scalar_t maxt = 0.0;
+		for (int i = 0; i < num_rays; i++) {
+			if ((cur.active & (1u << i)) && hit[i].maxt > maxt) {
+				maxt = hit[i].maxt;
+			}
+		}
+		if (cur.t > maxt) {
+			continue;
+		}
+
+		const BVHNode *node = nodes + cur.node;
+
+		if (cur.slot >= 0) {
+			for (int i = 0; i < num_rays; i++) {
+				if (cur.active & (1u << i)) {
+					leaf_intersection(node, cur.slot, packs, prims.data(), rays[i], rd[i], hit + i);
+				}
+			}
+			continue;
+		}
+
+		// find which rays hit each child, a child is visited if any of them does
+		uint32_t child_active[BVH_WIDTH] = {0};
+		scalar_t child_t[BVH_WIDTH] = {SCALAR_MAX, SCALAR_MAX, SCALAR_MAX, SCALAR_MAX};
+
+		for (int i = 0; i < num_rays; i++) {
+			if (!(cur.active & (1u << i))) {
+				continue;
+			}
+
+			alignas(32) scalar_t tnear[BVH_WIDTH];
+			int mask = node_intersection(node, rd[i], hit[i].maxt, tnear);
+
+			for (int j = 0; j < BVH_WIDTH; j++) {
+				if (mask & (1 << j)) {
+					child_active[j] |= 1u << i;
+					if (tnear[j] < child_t[j]) {
+						child_t[j] = tnear[j];
+					}
+				}
+			}
+		}
+
+		PacketEntry children[BVH_WIDTH];
+		int num_children = 0;
+
+		for (int i = 0; i < BVH_WIDTH; i++) {
+			if (!child_active[i]) {
+				continue;
+			}
+
+			int j = num_children++;
+			while (j > 0 && children[j - 1].t < child_t[i]) {
+				children[j] = children[j - 1];
+				j--;
+			}
+
+			if (node->num_packs[i] || node->num_objects[i]) {
+				children[j].node = cur.node;
+				children[j].slot = i;
+			} else {
+				children[j].node = node->child[i];
+				children[j].slot = -1;
+			}
+			children[j].active = child_active[i];
+			children[j].t = child_t[i];
+		}
+
+		for (int i = 0; i < num_children; i++) {
+			stack[top++] = children[i];
+		}
+	}
+
+	for (int i = 0; i < num_rays; i++) {
+		hits[i] = finish_ray(rays[i], hit[i], inf + i);
+	}
+}
+
+bool BVH::occluded(const Ray &ray) const {
+	if (!num_nodes) {
+		return false;
+	}
+
+	RayData rd;
+	HitData hit;
+	setup_ray(ray, &rd, &hit);
+
+	int stack[STACK_SIZE];
+	int top = 0;
+
+	stack[top++] = 0;
+
+	while (top) {
+		const BVHNode *node = nodes + stack[--top];
+
+		alignas(32) scalar_t tnear[BVH_WIDTH];
+		int mask = node_intersection(node, rd, ray.tmax, tnear);
+
+		/* any hit will do, so there's no point in sorting the children.
+		 * Test the leaves right away instead, they are the ones that can
+		 * end the search, and only then go down the inner nodes.
+		 */
+		for (int i = 0; i < BVH_WIDTH; i++) {
+			if (!(mask & (1 << i))) {
+				continue;
+			}
+
+			if (node->num_packs[i] || node->num_objects[i]) {
+				if (leaf_occluded(node, i, packs, prims.data(), ray, rd)) {
+					return true;
+				}
+			} else {
+				stack[top++] = node->child[i];
+			}
+		}
+	}
+	return false;
+}
+
+const BVHNode *BVH::get_nodes() const {
+	return nodes;
+}
+
+int BVH::get_node_count() const {
+	return num_nodes;
+}
+
+const SpherePack *BVH::get_packs() const {
+	return packs;
+}
+
+int BVH::get_pack_count() const {
+	return num_packs;
+}
+
+const Object * const *BVH::get_objects() const {
+	return prims.data();
+}
+
+int BVH::get_object_count() const {
+	return (int)prims.size();
+}
+
+static inline void setup_ray(const Ray &ray, RayData *rd, HitData *hit) {
+	scalar_t a = length_sq(ray.dir);
+
+	rd->origin[0] = p4_set1(ray.origin.x);
+	rd->origin[1] = p4_set1(ray.origin.y);
+	rd->origin[2] = p4_set1(ray.origin.z);
+	rd->dir[0] = p4_set1(ray.dir.x);
+	rd->dir[1] = p4_set1(ray.dir.y);
+	rd->dir[2] = p4_set1(ray.dir.z);
+	rd->invdir[0] = p4_set1(ray.invdir.x);
+	rd->invdir[1] = p4_set1(ray.invdir.y);
+	rd->invdir[2] = p4_set1(ray.invdir.z);
+
+	/* the slab distances are off by up to 3 roundings, which with floats is
+	 * enough to miss the box of a sphere that's grazed. Pushing the far
+	 * sides out by twice that keeps the test conservative. "Robust BVH Ray
+	 * Traversal", Thiago Ize, JCGT 2(2), 2013.
+	 */
+	const scalar_t eps = std::numeric_limits<scalar_t>::epsilon() / 2;
+	const scalar_t far_scale = 1 + 2 * (3 * eps / (1 - 3 * eps));
+	rd->far_invdir[0] = p4_set1(ray.invdir.x * far_scale);
+	rd->far_invdir[1] = p4_set1(ray.invdir.y * far_scale);
+	rd->far_invdir[2] = p4_set1(ray.invdir.z * far_scale);
+	rd->dir_neg[0] = ray.sign[0];
+	rd->dir_neg[1] = ray.sign[1];
+	rd->dir_neg[2] = ray.sign[2];
+	rd->tmin = p4_set1(ray.tmin);
+	rd->tmax = p4_set1(ray.tmax);
+	rd->a = p4_set1(a);
+	rd->inv_a = p4_set1(1.0 / a);
+
+	hit->isect.t = SCALAR_MAX;
+	hit->isect.object = 0;
+	hit->maxt = ray.tmax;
+	hit->pack = 0;
+	hit->lane = 0;
+}
+
+static inline bool finish_ray(const Ray &ray, const HitData &hit, IntInfo *inf) {
+	if (!hit.isect.object) {
+		return false;
+	}
+
+	if (inf) {
+		*inf = hit.isect;
+
+		if (hit.pack) {
+			Vector3 center(hit.pack->cx[hit.lane], hit.pack->cy[hit.lane], hit.pack->cz[hit.lane]);
+
+			/* the hit point is only as good as t, which is worse the further
+			 * the sphere is. Moving it back onto the sphere keeps it within
+			 * a few ulps of the surface, as offset_origin needs.
+			 */
+			Vector3 p = ray.origin + ray.dir * hit.isect.t;
+			inf->normal = normalize(p - center);
+			inf->i_point = center + inf->normal * hit.pack->radius[hit.lane];
+		}
+	}
+	return true;
+}
+
+static inline void leaf_intersection(const BVHNode *node, int slot, const SpherePack *packs,
+		const Object * const *prims, const Ray &ray, const RayData &rd, HitData *hit) {
+	for (int i = 0; i < node->num_packs[slot]; i++) {
+		const SpherePack *pack = packs + node->child[slot] + i;
+		scalar_t t;
+		int lane = pack_intersection(pack, rd, hit->maxt, &t);
+
+		if (lane >= 0 && t < hit->isect.t) {
+			hit->isect.t = hit->maxt = t;
+			hit->isect.object = prims[pack->object[lane]];
+			hit->pack = pack;
+			hit->lane = lane;
+		}
+	}
+
+	for (int i = 0; i < node->num_objects[slot]; i++) {
+		IntInfo tmp;
+		if (prims[node->objects[slot] + i]->intersection(ray, &tmp) && tmp.t < hit->isect.t) {
+			hit->isect = tmp;
+			hit->maxt = tmp.t;
+			hit->pack = 0;
+		}
+	}
+}
+
+static inline bool leaf_occluded(const BVHNode *node, int slot, const SpherePack *packs,
+		const Object * const *prims, const Ray &ray, const RayData &rd) {
+	for (int i = 0; i < node->num_packs[slot]; i++) {
+		if (pack_occluded(packs + node->child[slot] + i, rd)) {
+			return true;
+		}
+	}
+
+	for (int i = 0; i < node->num_objects[slot]; i++) {
+		if (prims[node->objects[slot] + i]->intersection(ray, 0)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* slab test of all the children of a node against the part of the ray that
+ * is still interesting, see BBox::intersection. Returns a mask of the
+ * children that got hit and their entry distances in tnear.
+ */
+static inline int node_intersection(const BVHNode *node, const RayData &rd, scalar_t maxt, scalar_t *tnear) {
+	STAT_INC(STAT_NODE_VISITS);
+
+	Pack4 tmin = rd.tmin;
+	Pack4 tmax = p4_set1(maxt);
+
+	for (int i = 0; i < 3; i++) {
+		Pack4 t0 = (p4_load(node->bounds[rd.dir_neg[i]][i]) - rd.origin[i]) * rd.invdir[i];
+		Pack4 t1 = (p4_load(node->bounds[1 - rd.dir_neg[i]][i]) - rd.origin[i]) * rd.far_invdir[i];
+
+		// a NaN slab (ray parallel to and on the plane) leaves the interval alone
+		tmin = p4_max(t0, tmin);
+		tmax = p4_min(t1, tmax);
+	}
+
+	p4_store(tnear, tmin);
+	return p4_le(tmin, tmax);
+}
+
+/* intersects the ray with the 4 spheres of a pack at once. Same math as
+ * Sphere::intersection, with b halved to drop the constant factors.
+ * Returns the lane of the closest hit in [tmin, maxt] or -1.
+ */
+static inline int pack_intersection(const SpherePack *pack, const RayData &rd, scalar_t maxt, scalar_t *t) {
+	STAT_INC(STAT_PACK_TESTS);
+
+	Pack4 ocx = rd.origin[0] - p4_load(pack->cx);
+	Pack4 ocy = rd.origin[1] - p4_load(pack->cy);
+	Pack4 ocz = rd.origin[2] - p4_load(pack->cz);
+
+	Pack4 b = rd.dir[0] * ocx + rd.dir[1] * ocy + rd.dir[2] * ocz;
+
+	/* b^2 - a * c, worked out as a * (r^2 - |f|^2), where f goes from the
+	 * center to the closest point of the line of the ray. The terms of the
+	 * former are about the same whenever the sphere is small next to its
+	 * distance from the origin, which with floats leaves little of their
+	 * difference. "Precision Improvements for Ray/Sphere Intersection",
+	 * Eric Haines et al., Ray Tracing Gems, 2019.
+	 */
+	Pack4 s = b * rd.inv_a;
+	Pack4 fx = ocx - rd.dir[0] * s;
+	Pack4 fy = ocy - rd.dir[1] * s;
+	Pack4 fz = ocz - rd.dir[2] * s;
+	Pack4 discr = rd.a * (p4_load(pack->rsq) - (fx * fx + fy * fy + fz * fz));
+
+	Pack4 zero = p4_set1(0.0);
+	Pack4 valid = p4_cmple(zero, discr);
+	if (!p4_mask(valid)) {
+		return -1;
+	}
+
+	Pack4 sqrt_discr = p4_sqrt(p4_max(discr, zero));
+	Pack4 t1 = (zero - b - sqrt_discr) * rd.inv_a;
+	Pack4 t2 = (sqrt_discr - b) * rd.inv_a;
+
+	// take the near root, unless it's behind the origin
+	Pack4 tres = p4_select(p4_cmple(rd.tmin, t1), t1, t2);
+
+	valid = p4_and(valid, p4_and(p4_cmple(rd.tmin, tres), p4_cmple(tres, p4_set1(maxt))));
+
+	int mask = p4_mask(valid);
+	if (!mask) {
+		return -1;
+	}
+
+	alignas(32) scalar_t tv[4];
+	p4_store(tv, tres);
+
+	int lane = -1;
+	for (int i = 0; i < 4; i++) {
+		if ((mask & (1 << i)) && (lane == -1 || tv[i] < tv[lane])) {
+			lane = i;
+		}
+	}
+	*t = tv[lane];
+	STAT_INC(STAT_PACK_HITS);
+	return lane;
+}
+
+// same as pack_intersection, but only tells if any of the spheres is hit in [tmin, tmax]
+static inline bool pack_occluded(const SpherePack *pack, const RayData &rd) {
+	STAT_INC(STAT_PACK_TESTS);
+
+	Pack4 ocx = rd.origin[0] - p4_load(pack->cx);
+	Pack4 ocy = rd.origin[1] - p4_load(pack->cy);
+	Pack4 ocz = rd.origin[2] - p4_load(pack->cz);
+
+	Pack4 b = rd.dir[0] * ocx + rd.dir[1] * ocy + rd.dir[2] * ocz;
+
+	Pack4 s = b * rd.inv_a;
+	Pack4 fx = ocx - rd.dir[0] * s;
+	Pack4 fy = ocy - rd.dir[1] * s;
+	Pack4 fz = ocz - rd.dir[2] * s;
+	Pack4 discr = rd.a * (p4_load(pack->rsq) - (fx * fx + fy * fy + fz * fz));
+
+	Pack4 zero = p4_set1(0.0);
+	Pack4 valid = p4_cmple(zero, discr);
+	if (!p4_mask(valid)) {
+		return false;
+	}
+
+	Pack4 sqrt_discr = p4_sqrt(p4_max(discr, zero));
+	Pack4 t1 = (zero - b - sqrt_discr) * rd.inv_a;
+	Pack4 t2 = (sqrt_discr - b) * rd.inv_a;
+
+	Pack4 t = p4_select(p4_cmple(rd.tmin, t1), t1, t2);
+
+	valid = p4_and(valid, p4_and(p4_cmple(rd.tmin, t), p4_cmple(t, rd.tmax)));
+	if (!p4_mask(valid)) {
+		return false;
+	}
+	STAT_INC(STAT_PACK_HITS);
+	return true;
+}
+
+static int build_node(BuildData *bd, int start, int count, int depth) {
+	BBox bounds, cbounds;
+	bounds.reset();
+	cbounds.reset();
+
+	for (int i = start; i < start + count; i++) {
+		bounds.include(bd->prims[i].bbox);
+		cbounds.include(bd->prims[i].center);
+	}
+
+	int idx = (int)bd->bin.size();
+	bd->bin.push_back(BuildNode());
+	bd->bin[idx].bbox = bounds;
+
+	int split = 0;
+	if (count > 1) {
+		if (depth < SAH_MAX_DEPTH) {
+			split = find_split(&bd->prims[start], count, bounds, cbounds);
+		} else if (count > BVH_LEAF_SIZE) {
+			split = count / 2;
+		}
+	}
+
+	if (!split) {
+		bd->bin[idx].offset = start;
+		bd->bin[idx].count = count;
+		return idx;
+	}
+
+	// the first child goes right after this node, and the push_backs move the nodes
+	build_node(bd, start, split, depth + 1);
+	int second = build_node(bd, start + split, count - split, depth + 1);
+
+	bd->bin[idx].offset = second;
+	bd->bin[idx].count = 0;
+	return idx;
+}
+
+/* turns the binary subtree at idx into a 4-wide node, by opening up the
+ * largest inner node among its children until there are 4 of them.
+ */
+static int collapse(BuildData *bd, int idx, int depth) {
+	const std::vector<BuildNode> &bin = bd->bin;
+	int slots[BVH_WIDTH];
+	int num_slots;
+
+	if (bin[idx].count) {
+		// only happens if the whole tree is a single leaf
+		slots[0] = idx;
+		num_slots = 1;
+	} else {
+		slots[0] = idx + 1;
+		slots[1] = bin[idx].offset;
+		num_slots = 2;
+	}
+
+	while (num_slots < BVH_WIDTH) {
+		int best = -1;
+		double best_area = -1.0;
+
+		for (int i = 0; i < num_slots; i++) {
+			const BuildNode &n = bin[slots[i]];
+			if (!n.count && n.bbox.surface_area() > best_area) {
+				best_area = n.bbox.surface_area();
+				best = i;
+			}
+		}
+		if (best == -1) {
+			break;
+		}
+
+		int open = slots[best];
+		slots[best] = open + 1;
+		slots[num_slots++] = bin[open].offset;
+	}
+
+	int widx = (int)bd->nodes.size();
+	bd->nodes.push_back(BVHNode());
+
+	bd->stats->num_nodes++;
+	if (depth > bd->stats->max_depth) {
+		bd->stats->max_depth = depth;
+	}
+
+	for (int i = 0; i < BVH_WIDTH; i++) {
+		BBox bbox;
+		int child = -1;
+
+		if (i < num_slots) {
+			bbox = bin[slots[i]].bbox;
+
+			if (!bin[slots[i]].count) {
+				child = collapse(bd, slots[i], depth + 1);
+			}
+		} else {
+			bbox.reset();
+		}
+
+		// the recursion moves the nodes around
+		BVHNode *node = &bd->nodes[widx];
+		node->bounds[0][0][i] = bbox.min.x;
+		node->bounds[0][1][i] = bbox.min.y;
+		node->bounds[0][2][i] = bbox.min.z;
+		node->bounds[1][0][i] = bbox.max.x;
+		node->bounds[1][1][i] = bbox.max.y;
+		node->bounds[1][2][i] = bbox.max.z;
+		node->child[i] = child;
+		node->objects[i] = -1;
+		node->num_packs[i] = node->num_objects[i] = 0;
+
+		if (i < num_slots && bin[slots[i]].count) {
+			make_leaf(bd, bin[slots[i]], node, i);
+		}
+	}
+	return widx;
+}
+
+// moves the primitives of a binary leaf to the sphere packs and object list
+static void make_leaf(BuildData *bd, const BuildNode &leaf, BVHNode *node, int slot) {
+	int num_spheres = (int)bd->spheres.size();
+	int first_pack = (int)bd->packs.size();
+	int first_obj = (int)bd->leaf_objects.size();
+
+	SpherePack pack;
+	memset(&pack, 0, sizeof pack);
+	int lane = 0;
+
+	for (int i = leaf.offset; i < leaf.offset + leaf.count; i++) {
+		int idx = bd->prims[i].index;
+
+		if (idx >= num_spheres) {
+			bd->leaf_objects.push_back(bd->objects[idx - num_spheres]);
+			continue;
+		}
+
+		const BVHSphere &sph = bd->spheres[idx];
+		pack.cx[lane] = sph.center.x;
+		pack.cy[lane] = sph.center.y;
+		pack.cz[lane] = sph.center.z;
+		pack.rsq[lane] = sph.radius * sph.radius;
+		pack.radius[lane] = sph.radius;
+		pack.object[lane] = sph.owner;
+
+		if (++lane == 4) {
+			bd->packs.push_back(pack);
+			lane = 0;
+		}
+	}
+
+	if (lane) {
+		for (int i = lane; i < 4; i++) {
+			pack.cx[i] = pack.cy[i] = pack.cz[i] = 0.0;
+			pack.rsq[i] = -1.0;
+			pack.radius[i] = 1.0;
+			pack.object[i] = -1;
+		}
+		bd->packs.push_back(pack);
+	}
+
+	node->child[slot] = first_pack;
+	node->num_packs[slot] = (int)bd->packs.size() - first_pack;
+	node->objects[slot] = first_obj;
+	node->num_objects[slot] = (int)bd->leaf_objects.size() - first_obj;
+
+	bd->stats->num_leaves++;
+}
+
+/* finds the cheapest split according to the SAH, partitions the primitives
+ * around it and returns the number of them that went to the left side,
+ * or 0 if it's cheaper to make a leaf.
+ */
+static int find_split(BuildPrim *prims, int count, const BBox &bounds, const BBox &cbounds) {
+	double area = bounds.surface_area();
+	double inv_area = area > 0.0 ? 1.0 / area : 1.0;
+
+	double best_cost = DBL_MAX;
+	int best_axis = -1;
+	int best_bin = 0;
+
+	for (int axis = 0; axis < 3; axis++) {
+		double cmin = get_axis(cbounds.min, axis);
+		double extent = get_axis(cbounds.max, axis) - cmin;
+		if (extent < EPSILON) {
+			continue;
+		}
+		double scale = BVH_BINS / extent;
+
+		Bin bins[BVH_BINS];
+		for (int i = 0; i < BVH_BINS; i++) {
+			bins[i].bbox.reset();
+			bins[i].count = 0;
+		}
+
+		for (int i = 0; i < count; i++) {
+			int b = get_bin(prims[i].center, axis, cmin, scale);
+			bins[b].count++;
+			bins[b].bbox.include(prims[i].bbox);
+		}
+
+		// sweep from the right to get the cost of everything after each split
+		double right_area[BVH_BINS];
+		int right_count[BVH_BINS];
+		BBox rbox;
+		rbox.reset();
+		int rcount = 0;
+
+		for (int i = BVH_BINS - 1; i > 0; i--) {
+			rbox.include(bins[i].bbox);
+			rcount += bins[i].count;
+			right_area[i] = rbox.surface_area();
+			right_count[i] = rcount;
+		}
+
+		// and then from the left, splitting after bin i
+		BBox lbox;
+		lbox.reset();
+		int lcount = 0;
+
+		for (int i = 0; i < BVH_BINS - 1; i++) {
+			lbox.include(bins[i].bbox);
+			lcount += bins[i].count;
+
+			if (!lcount || !right_count[i + 1]) {
+				continue;
+			}
+
+			double cost = TRAV_COST + ISECT_COST * inv_area *
+				(lbox.surface_area() * lcount + right_area[i + 1] * right_count[i + 1]);
+
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = i;
+			}
+		}
+	}
+
+	if (best_axis == -1) {
+		/* all the centroids are in the same spot, there's nothing the
+		 * heuristic can do, so split in the middle if we can't make a leaf
+		 */
+		return count > BVH_LEAF_SIZE ? count / 2 : 0;
+	}
+
+	if (best_cost >= ISECT_COST * count && count <= BVH_LEAF_SIZE) {
+		return 0;
+	}
+
+	double cmin = get_axis(cbounds.min, best_axis);
+	double scale = BVH_BINS / (get_axis(cbounds.max, best_axis) - cmin);
+
+	int mid = 0;
+	for (int i = 0; i < count; i++) {
+		if (get_bin(prims[i].center, best_axis, cmin, scale) <= best_bin) {
+			BuildPrim tmp = prims[i];
+			prims[i] = prims[mid];
+			prims[mid++] = tmp;
+		}
+	}
+
+	return mid;
+}
+
+static int get_bin(const Vector3 &c, int axis, double cmin, double scale) {
+	int b = (int)((get_axis(c, axis) - cmin) * scale);
+	return b < 0 ? 0 : (b >= BVH_BINS ? BVH_BINS - 1 : b);
+}
+
+static double get_axis(const Vector3 &v, int axis) {
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// returns size bytes aligned to a cache line, mem is what has to be freed
+static void *alloc_aligned(size_t size, void **mem) {
+	*mem = malloc(size + 63);
+	return (void*)(((uintptr_t)*mem + 63) & ~(uintptr_t)63);
+}
@@ -0,0 +1,140 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef BVH_H_
+#define BVH_H_
+
+#include <stdint.h>
+#include <vector>
+#include "bbox.h"
+#include "intinfo.h"
+#include "ray.h"
+
+class Object;
+
+#define BVH_WIDTH	4
+
+// most rays that can go through the hierarchy together as a packet
+#define BVH_MAX_PACKET	32
+
+/* node of the flattened 4-wide hierarchy, aligned to a cache line. The
+ * bounds of the children are kept together, one array per axis, so that
+ * they can be tested against a ray at once. child is the index of an
+ * inner node, or for leaves the index of their first sphere pack, and
+ * objects the index of their first generic object in the object table of
+ * the hierarchy. A slot is a leaf if
+ * it has any packs or objects. Unused slots have empty bounds and never
+ * get hit.
+ */
+struct BVHNode {
+	scalar_t bounds[2][3][BVH_WIDTH];	// [min, max][axis][child]
+	int32_t child[BVH_WIDTH];
+	int32_t objects[BVH_WIDTH];
+	uint8_t num_packs[BVH_WIDTH];
+	uint8_t num_objects[BVH_WIDTH];
+	uint8_t pad[sizeof(scalar_t) == 4 ? 56 : 24];	// to 3 or 4 cache lines
+};
+
+/* a sphere that goes straight into the leaves of the hierarchy. It gets
+ * reported as a hit on the object it came from.
+ */
+struct BVHSphere {
+	Vector3 center;
+	scalar_t radius;
+	int owner;	// index in the object table, filled in by BVH::build
+};
+
+/* up to 4 spheres of a leaf in SoA form, for the vectorized intersection.
+ * Unused lanes have a negative squared radius and can't be hit. There are
+ * no pointers in here or in the nodes, so that a built hierarchy can be
+ * stored in a file and used straight from there, see scenecache.h.
+ */
+struct SpherePack {
+	scalar_t cx[4], cy[4], cz[4];
+	scalar_t rsq[4];
+	scalar_t radius[4];
+	int32_t object[4];	// index in the object table, -1 for unused lanes
+	uint8_t pad[sizeof(scalar_t) == 4 ? 32 : 16];	// to 2 or 3 cache lines
+};
+
+struct BVHStats {
+	int num_nodes;
+	int num_leaves;
+	int max_depth;
+	int num_spheres;
+};
+
+class BVH {
+private:
+	const BVHNode *nodes;
+	int num_nodes;
+	const SpherePack *packs;
+	int num_packs;
+	void *node_mem, *pack_mem;
+
+	/* the objects the spheres of the packs belong to, followed by the
+	 * generic objects of the leaves.
+	 */
+	std::vector<const Object*> prims;
+
+public:
+	BVH();
+	~BVH();
+
+	/* builds a binary hierarchy over the objects using the binned surface
+	 * area heuristic and collapses it to a 4-wide one. Objects that are
+	 * made of spheres are broken down to them, the rest are intersected
+	 * through their intersection function and must have their bounding
+	 * boxes calculated. stats can be null.
+	 */
+	void build(Object * const *objects, int num_objects, BVHStats *stats);
+
+	/* uses an already built hierarchy instead, like the one of a scene
+	 * cache. The nodes and packs aren't copied and have to stay around for
+	 * as long as the bvh is used.
+	 */
+	void set_data(const BVHNode *nodes, int num_nodes, const SpherePack *packs, int num_packs,
+			const Object * const *objects, int num_objects);
+
+	bool intersection(const Ray &ray, IntInfo *inf) const;
+
+	/* intersects a packet of coherent rays, like the primary rays of
+	 * neighbouring pixels, visiting every node once for all of them, up to
+	 * BVH_MAX_PACKET rays at a time. hits[i] is set if ray i hit anything, in which case inf[i]
+	 * is filled in. Falls back to tracing the rays one by one if they point
+	 * in different directions.
+	 */
+	void intersection(const Ray *rays, int num_rays, IntInfo *inf, bool *hits) const;
+
+	/* tells if anything is hit along the ray, stopping at the first hit
+	 * found without calculating any hit information. Meant for shadow rays.
+	 */
+	bool occluded(const Ray &ray) const;
+
+	const BVHNode *get_nodes() const;
+	int get_node_count() const;
+	const SpherePack *get_packs() const;
+	int get_pack_count() const;
+	const Object * const *get_objects() const;
+	int get_object_count() const;
+};
+
+#endif
@@ -23,66 +23,91 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #include "camera.h"
 #include "config.h"
 
-extern int width, height;
-
 Camera::Camera() {
 	this->position = Vector3(0,0,0);
 	this->target = Vector3(0,0,1);
 	fov = M_PI/4;
+	width = height = 512;
+	calc_frame();
 }
 
 Camera::Camera(const Vector3 &position, const Vector3 &target) {
 	this->position = position;
 	this->target = target;
 	fov = M_PI/4;
+	width = height = 512;
+	calc_frame();
 }
 
 void Camera::set_position(const Vector3 &position) {
 	this->position = position;
+	calc_frame();
 }
 
 void Camera::set_target(const Vector3 &target) {
 	this->target = target;
+	calc_frame();
 }
 
 void Camera::set_fov(double fov) {
 	this->fov = fov;
+	calc_frame();
 }
 
-Ray Camera::get_primary_ray(int x, int y) {
-	Ray prim_ray;
-	Vector3 dir;
-
-	dir.x = 2.0 * (double)x / (double)width - 1.0;
-	dir.y = 1.0 - 2.0 * (double)y / (double)height;
-	dir.z = 1.0 / tan(fov / 2.0);
+const Vector3 &Camera::get_position() const {
+	return position;
+}
 
-	Vector3 up(0,1,0); 
-	Vector3 d = normalize(target-position);
+const Vector3 &Camera::get_target() const {
+	return target;
+}
 
-	Vector3 i,j,k;
-	
-	i = cross(up, d);
-	j = cross(d, i);
-	k = d;
+double Camera::get_fov() const {
+	return fov;
+}
 
-	Matrix4x4 m;
+void Camera::set_image_size(int width, int height) {
+	this->width = width;
+	this->height = height;
+}
 
-	m.matrix[0][0] = i.x; 
-	m.matrix[1][0] = i.y;
-	m.matrix[2][0] = i.z;
+void Camera::calc_frame() {
+	Vector3 vup(0,1,0);
+	Vector3 d = normalize(target-position);
 
-	m.matrix[0][1] = j.x;
-	m.matrix[1][1] = j.y;
-	m.matrix[2][1] = j.z;
+	right = cross(vup, d);
+	up = cross(d, right);
+	forward = d;
 
-	m.matrix[0][2] = k.x;
-	m.matrix[1][2] = k.y;
-	m.matrix[2][2] = k.z;
+	focal = 1.0 / tan(fov / 2.0);
+}
 
-	prim_ray.origin = position;
-	dir.transform(m);
-	prim_ray.dir = dir * RAY_MAG;
+Ray Camera::get_primary_ray(int x, int y) const {
+	Ray prim_ray;
+	get_primary_rays(x, y, 1, 1, &prim_ray);
 	return prim_ray;
 }
 
+Ray Camera::get_sample_ray(double x, double y) const {
+	double dx = 2.0 * x / (double)width - 1.0;
+	double dy = 1.0 - 2.0 * y / (double)height;
+
+	return Ray(position, (right * dx + up * dy + forward * focal) * RAY_MAG);
+}
+
+void Camera::get_primary_rays(int x, int y, int w, int h, Ray *rays) const {
+	// the parts of the direction that don't change along a scanline
+	Vector3 fdir = forward * focal;
+
+	for (int i = 0; i < h; i++) {
+		double dy = 1.0 - 2.0 * (double)(y + i) / (double)height;
+		Vector3 udir = up * dy;
+
+		for (int j = 0; j < w; j++) {
+			double dx = 2.0 * (double)(x + j) / (double)width - 1.0;
+
+			rays->set(position, (right * dx + udir + fdir) * RAY_MAG);
+			rays++;
+		}
+	}
+}
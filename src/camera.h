@@ -22,7 +22,6 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #ifndef CAMERA_H_
 #define CAMERA_H_
 
-#include "matrix.h"
 #include "ray.h"
 #include "vector.h"
 
@@ -31,13 +30,37 @@ private:
 	Vector3 position;
 	Vector3 target;
 	double fov;
+	int width, height;
+
+	// camera frame, recalculated whenever any of the above changes
+	Vector3 right, up, forward;
+	double focal;
+
+	void calc_frame();
+
 public:
 	Camera();
 	Camera(const Vector3 &position, const Vector3 &target);
 	void set_position(const Vector3 &position);
 	void set_target(const Vector3 &target);
 	void set_fov(double fov);
-	Ray get_primary_ray(int x, int y);
+	void set_image_size(int width, int height);
+
+	const Vector3 &get_position() const;
+	const Vector3 &get_target() const;
+	double get_fov() const;
+
+	Ray get_primary_ray(int x, int y) const;
+
+	/* same as get_primary_ray, at any point of the image plane. Pixel x, y
+	 * is sampled at its top left corner, x + 1, y + 1 is the opposite one.
+	 */
+	Ray get_sample_ray(double x, double y) const;
+
+	/* writes the primary rays of the w x h block of pixels starting at x, y
+	 * to rays, in scanline order.
+	 */
+	void get_primary_rays(int x, int y, int w, int h, Ray *rays) const;
 };
 
 #endif
@@ -22,9 +22,40 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #ifndef CONFIG_H_
 #define CONFIG_H_
 
+#include <float.h>
+
+/* type of all the geometry: vectors, rays, bounds and primitives. Builds
+ * with -DRT_FLOAT use single precision, which halves the size of the bvh
+ * and doubles the width of its vector tests. Doubles are the default, for
+ * reference renders.
+ */
+#ifdef RT_FLOAT
+typedef float scalar_t;
+#define SCALAR_MAX	FLT_MAX
+#else
+typedef double scalar_t;
+#define SCALAR_MAX	DBL_MAX
+#endif
+
 #define EPSILON		1e-6
+#define RAY_OFFSET_ULPS	32.0	// how far secondary rays start off the surface, see offset_origin
 #define RAY_MAG		10000.0
 #define MAX_DEPTH	5
+#define TILE_SIZE	32
+#define PACKET_SIZE	4	// primary rays are traced in 4x4 packets
+#define PRESENT_INTERVAL	50	// msec between partial updates of the window
+#define PATH_CUTOFF	0.001	// least weight a reflection needs to get traced (-cutoff)
+
+// adaptive anti-aliasing (-aa)
+#define AA_THRESHOLD	0.1	// max difference of any color channel before a pixel gets split
+#define AA_MAX_DEPTH	2	// times a pixel can be split in 4, 2 -> up to 5x5 samples
+
+// scene files get parsed in pieces of at least this many bytes, one thread each
+#define PARSE_CHUNK_SIZE	(1 << 20)
+
+#define BVH_BINS		16
+#define BVH_LEAF_SIZE	4
+#define BVH_MAX_DEPTH	64
 
 #define USE_BBOX
 
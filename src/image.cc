@@ -0,0 +1,325 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <string.h>
+#include "image.h"
+
+#define QOI_OP_INDEX	0x00
+#define QOI_OP_DIFF		0x40
+#define QOI_OP_LUMA		0x80
+#define QOI_OP_RUN		0xc0
+#define QOI_OP_RGB		0xfe
+
+#define QOI_HASH(p) \
+	((((p) >> 16 & 0xff) * 3 + ((p) >> 8 & 0xff) * 5 + ((p) & 0xff) * 7 + 255 * 11) % 64)
+
+static bool seek_to(FILE *fp, int64_t offs);
+static void put_be32(unsigned char *p, uint32_t x);
+static bool is_little_endian();
+
+ImageFormat image_format(const char *fname) {
+	const char *suffix = strrchr(fname, '.');
+
+	if (suffix) {
+		if (strcmp(suffix, ".pfm") == 0 || strcmp(suffix, ".PFM") == 0) {
+			return IMG_PFM;
+		}
+		if (strcmp(suffix, ".qoi") == 0 || strcmp(suffix, ".QOI") == 0) {
+			return IMG_QOI;
+		}
+	}
+	return IMG_PPM;
+}
+
+ImageWriter::ImageWriter() {
+	fp = 0;
+	fmt = IMG_PPM;
+	width = height = 0;
+	next_row = 0;
+	data_start = 0;
+	failed = false;
+	pend_pixels = 0;
+	pend_hdr = 0;
+	pend_rows = 0;
+	quit = false;
+}
+
+ImageWriter::~ImageWriter() {
+	if (fp) {
+		close();
+	}
+}
+
+bool ImageWriter::open(const char *fname, ImageFormat fmt, int width, int height) {
+	if (!(fp = fopen(fname, "wb"))) {
+		return false;
+	}
+
+	this->fmt = fmt;
+	this->width = width;
+	this->height = height;
+	next_row = 0;
+	failed = false;
+
+	switch (fmt) {
+	case IMG_PPM:
+		fprintf(fp, "P6\n%d %d\n255\n", width, height);
+		break;
+
+	case IMG_PFM:
+		// a negative scale marks little endian data
+		fprintf(fp, "PF\n%d %d\n%s\n", width, height, is_little_endian() ? "-1.0" : "1.0");
+		break;
+
+	case IMG_QOI:
+		{
+			unsigned char hdr[14];
+			memcpy(hdr, "qoif", 4);
+			put_be32(hdr + 4, width);
+			put_be32(hdr + 8, height);
+			hdr[12] = 3;	// rgb
+			hdr[13] = 0;	// srgb
+			fwrite(hdr, 1, sizeof hdr, fp);
+
+			// the colors are kept with an opaque alpha, like the decoder sees them
+			memset(qoi_index, 0, sizeof qoi_index);
+			qoi_prev = 0xff000000;
+			qoi_run = 0;
+		}
+		break;
+	}
+
+	data_start = ftell(fp);
+	if (data_start < 0 || ferror(fp)) {
+		fclose(fp);
+		fp = 0;
+		return false;
+	}
+
+	quit = false;
+	pend_rows = 0;
+	thread = std::thread(&ImageWriter::writer, this);
+	return true;
+}
+
+bool ImageWriter::write_rows(const uint32_t *pixels, const float *hdr, int num_rows) {
+	std::unique_lock<std::mutex> ulock(lock);
+	wait_idle(ulock);
+
+	pend_pixels = pixels;
+	pend_hdr = hdr;
+	pend_rows = num_rows;
+	cond.notify_all();
+
+	return !failed;
+}
+
+bool ImageWriter::close() {
+	if (!fp) {
+		return false;
+	}
+
+	{
+		std::unique_lock<std::mutex> ulock(lock);
+		wait_idle(ulock);
+		quit = true;
+		cond.notify_all();
+	}
+	thread.join();
+
+	if (fmt == IMG_QOI) {
+		static const unsigned char end_marker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+		if (qoi_run) {
+			fputc(QOI_OP_RUN | (qoi_run - 1), fp);
+		}
+		fwrite(end_marker, 1, sizeof end_marker, fp);
+	}
+
+	if (ferror(fp) || next_row != height) {
+		failed = true;
+	}
+	if (fclose(fp) == EOF) {
+		failed = true;
+	}
+	fp = 0;
+	return !failed;
+}
+
+bool ImageWriter::needs_hdr() const {
+	return fmt == IMG_PFM;
+}
+
+void ImageWriter::wait_idle(std::unique_lock<std::mutex> &ulock) {
+	while (pend_rows) {
+		cond.wait(ulock);
+	}
+}
+
+void ImageWriter::writer() {
+	std::unique_lock<std::mutex> ulock(lock);
+
+	for (;;) {
+		while (!pend_rows && !quit) {
+			cond.wait(ulock);
+		}
+		if (!pend_rows) {
+			break;
+		}
+
+		// write without holding the lock, the caller is busy rendering
+		ulock.unlock();
+		bool res = write_band(pend_pixels, pend_hdr, pend_rows);
+		ulock.lock();
+
+		if (!res) {
+			failed = true;
+		}
+		pend_rows = 0;
+		cond.notify_all();
+	}
+}
+
+bool ImageWriter::write_band(const uint32_t *pixels, const float *hdr, int num_rows) {
+	if (next_row + num_rows > height) {
+		return false;
+	}
+
+	switch (fmt) {
+	case IMG_PPM:
+		encode_ppm(pixels, num_rows);
+		break;
+
+	case IMG_PFM:
+		/* pfm rows go from the bottom of the image to the top, so every band
+		 * goes in its own place before the bands above it
+		 */
+		encode_pfm(hdr, num_rows);
+		if (!seek_to(fp, data_start + (int64_t)(height - next_row - num_rows) * width * 12)) {
+			return false;
+		}
+		break;
+
+	case IMG_QOI:
+		encode_qoi(pixels, num_rows);
+		break;
+	}
+	next_row += num_rows;
+
+	return fwrite(buf.data(), 1, buf.size(), fp) == buf.size();
+}
+
+void ImageWriter::encode_ppm(const uint32_t *pixels, int num_rows) {
+	size_t num_pixels = (size_t)width * num_rows;
+	buf.resize(num_pixels * 3);
+
+	unsigned char *dest = buf.data();
+	for (size_t i = 0; i < num_pixels; i++) {
+		uint32_t pix = *pixels++;
+		*dest++ = (pix >> 16) & 0xff;
+		*dest++ = (pix >> 8) & 0xff;
+		*dest++ = pix & 0xff;
+	}
+}
+
+void ImageWriter::encode_pfm(const float *hdr, int num_rows) {
+	size_t row_size = (size_t)width * 12;
+	buf.resize(row_size * num_rows);
+
+	// the floats stay in native byte order, the header says which one it is
+	for (int i = 0; i < num_rows; i++) {
+		memcpy(buf.data() + (num_rows - 1 - i) * row_size, hdr + (size_t)i * width * 3, row_size);
+	}
+}
+
+/* see the qoi specification at https://qoiformat.org. Runs and the index of
+ * recent colors carry over between bands, the last run is flushed by close.
+ */
+void ImageWriter::encode_qoi(const uint32_t *pixels, int num_rows) {
+	size_t num_pixels = (size_t)width * num_rows;
+	buf.resize(num_pixels * 4);		// worst case, every pixel as QOI_OP_RGB
+
+	unsigned char *dest = buf.data();
+	for (size_t i = 0; i < num_pixels; i++) {
+		uint32_t pix = pixels[i] | 0xff000000;
+
+		if (pix == qoi_prev) {
+			if (++qoi_run == 62) {
+				*dest++ = QOI_OP_RUN | (qoi_run - 1);
+				qoi_run = 0;
+			}
+			continue;
+		}
+
+		if (qoi_run) {
+			*dest++ = QOI_OP_RUN | (qoi_run - 1);
+			qoi_run = 0;
+		}
+
+		int idx = QOI_HASH(pix);
+		if (qoi_index[idx] == pix) {
+			*dest++ = QOI_OP_INDEX | idx;
+		} else {
+			qoi_index[idx] = pix;
+
+			int dr = (int)(signed char)((pix >> 16) - (qoi_prev >> 16));
+			int dg = (int)(signed char)((pix >> 8) - (qoi_prev >> 8));
+			int db = (int)(signed char)(pix - qoi_prev);
+			int dr_dg = dr - dg;
+			int db_dg = db - dg;
+
+			if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+				*dest++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+			} else if (dg > -33 && dg < 32 && dr_dg > -9 && dr_dg < 8 && db_dg > -9 && db_dg < 8) {
+				*dest++ = QOI_OP_LUMA | (dg + 32);
+				*dest++ = (dr_dg + 8) << 4 | (db_dg + 8);
+			} else {
+				*dest++ = QOI_OP_RGB;
+				*dest++ = (pix >> 16) & 0xff;
+				*dest++ = (pix >> 8) & 0xff;
+				*dest++ = pix & 0xff;
+			}
+		}
+		qoi_prev = pix;
+	}
+
+	buf.resize(dest - buf.data());
+}
+
+static bool seek_to(FILE *fp, int64_t offs) {
+#if defined(WIN32) || defined(__WIN32__)
+	return _fseeki64(fp, offs, SEEK_SET) == 0;
+#else
+	return fseeko(fp, (off_t)offs, SEEK_SET) == 0;
+#endif
+}
+
+static void put_be32(unsigned char *p, uint32_t x) {
+	p[0] = x >> 24;
+	p[1] = x >> 16;
+	p[2] = x >> 8;
+	p[3] = x;
+}
+
+static bool is_little_endian() {
+	uint32_t x = 1;
+	return *(unsigned char*)&x == 1;
+}
@@ -0,0 +1,97 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+enum ImageFormat {
+	IMG_PPM,	// binary 8 bit rgb
+	IMG_PFM,	// binary float rgb, unclamped
+	IMG_QOI		// "quite ok image" lossless compressed rgb
+};
+
+// picks the format from the file suffix, anything unknown is a ppm
+ImageFormat image_format(const char *fname);
+
+/* writes an image file a band of rows at a time, top to bottom. The rows are
+ * converted, encoded and written out on a thread of its own, so the caller
+ * can get on with the next band in the meantime.
+ */
+class ImageWriter {
+private:
+	FILE *fp;
+	ImageFormat fmt;
+	int width, height;
+	int next_row;
+	int64_t data_start;	// file offset of the first row of pixels
+	bool failed;
+
+	// output bytes of the band being written
+	std::vector<unsigned char> buf;
+
+	// qoi encoder state, carried over from band to band
+	uint32_t qoi_index[64];
+	uint32_t qoi_prev;
+	int qoi_run;
+
+	// the band waiting for the writer thread
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable cond;
+	const uint32_t *pend_pixels;
+	const float *pend_hdr;
+	int pend_rows;
+	bool quit;
+
+	void writer();
+	bool write_band(const uint32_t *pixels, const float *hdr, int num_rows);
+	void encode_ppm(const uint32_t *pixels, int num_rows);
+	void encode_pfm(const float *hdr, int num_rows);
+	void encode_qoi(const uint32_t *pixels, int num_rows);
+	void wait_idle(std::unique_lock<std::mutex> &ulock);
+
+public:
+	ImageWriter();
+	~ImageWriter();
+
+	bool open(const char *fname, ImageFormat fmt, int width, int height);
+
+	/* pixels are packed 0xRRGGBB, hdr holds 3 floats per pixel and is only
+	 * needed for formats with needs_hdr. Returns once the previous band has
+	 * been written, after which its buffers can be reused, and false if
+	 * writing anything so far failed.
+	 */
+	bool write_rows(const uint32_t *pixels, const float *hdr, int num_rows);
+
+	// waits for the last band and finishes the file
+	bool close();
+
+	bool needs_hdr() const;
+};
+
+#endif
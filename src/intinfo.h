@@ -29,7 +29,7 @@ class Object;
 struct IntInfo {
 	Vector3 normal;
 	Vector3 i_point;
-	double t;
+	scalar_t t;
 	const Object* object;
 };
 
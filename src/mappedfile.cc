@@ -0,0 +1,125 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "mappedfile.h"
+
+#if defined(unix) || defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_MMAP
+#endif
+
+MappedFile::MappedFile() {
+	data = 0;
+	size = 0;
+	mapped = false;
+	mem = 0;
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef HAVE_MMAP
+bool MappedFile::open(const char *fname) {
+	close();
+
+	int fd;
+	if ((fd = ::open(fname, O_RDONLY)) == -1) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size <= 0) {
+		::close(fd);
+		return false;
+	}
+	size = (size_t)st.st_size;
+
+	void *ptr = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (ptr == MAP_FAILED) {
+		size = 0;
+		return false;
+	}
+	data = ptr;
+	mapped = true;
+	return true;
+}
+#else
+// no mmap, read it all to a cache line aligned buffer instead
+bool MappedFile::open(const char *fname) {
+	close();
+
+	FILE *fp;
+	if (!(fp = fopen(fname, "rb"))) {
+		return false;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	long len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if (len <= 0) {
+		fclose(fp);
+		return false;
+	}
+	size = (size_t)len;
+
+	mem = malloc(size + MAPPED_FILE_ALIGN - 1);
+	data = (void*)(((uintptr_t)mem + MAPPED_FILE_ALIGN - 1) & ~(uintptr_t)(MAPPED_FILE_ALIGN - 1));
+
+	bool res = fread(data, 1, size, fp) == size;
+	fclose(fp);
+
+	if (!res) {
+		close();
+	}
+	return res;
+}
+#endif
+
+void MappedFile::close() {
+#ifdef HAVE_MMAP
+	if (mapped) {
+		munmap(data, size);
+	}
+#endif
+	free(mem);
+
+	data = mem = 0;
+	size = 0;
+	mapped = false;
+}
+
+const void *MappedFile::get_data() const {
+	return data;
+}
+
+size_t MappedFile::get_size() const {
+	return size;
+}
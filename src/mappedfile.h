@@ -0,0 +1,51 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef MAPPEDFILE_H_
+#define MAPPEDFILE_H_
+
+#include <stddef.h>
+
+// alignment of the data when the file has to be read instead
+#define MAPPED_FILE_ALIGN	64
+
+/* a whole file in memory, mapped where the platform can do it and read
+ * otherwise. Empty files fail to open, there is nothing to map.
+ */
+class MappedFile {
+private:
+	void *data;
+	size_t size;
+	bool mapped;
+	void *mem;	// the buffer data is in, when it's read
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool open(const char *fname);
+	void close();
+
+	const void *get_data() const;
+	size_t get_size() const;
+};
+
+#endif
@@ -20,13 +20,28 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 */
 
 #include "object.h"
+#include "bvh.h"
 
-Object::Object(){}
+Object::Object() {
+	material = -1;
+}
+
+int Object::get_material() const {
+	return material;
+}
+
+void Object::set_material(int material) {
+	this->material = material;
+}
+
+const BBox &Object::get_bbox() const {
+	return bbox;
+}
 
-Material* Object::get_material() {
-	return &material;
+bool Object::get_spheres(std::vector<BVHSphere>*) const {
+	return false;
 }
 
-const Material* Object::get_material() const {
-	return &material;
+bool Object::is_bounded() const {
+	return true;
 }
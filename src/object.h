@@ -22,11 +22,14 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #ifndef OBJECT_H_
 #define OBJECT_H_
 
+#include <vector>
 #include "color.h"
 #include "intinfo.h"
 #include "ray.h"
 #include "bbox.h"
 
+struct BVHSphere;
+
 struct Material {
 	Color kd;
 	Color ks;
@@ -36,17 +39,33 @@ struct Material {
 		
 class Object {
 protected:
-	Material material;
+	int material;	// index in the material table of the scene, see Scene::add_material
 	BBox bbox;
 
 public:
 	Object();
 	virtual bool intersection(const Ray &ray, IntInfo* i_info) const = 0;
 
-	Material* get_material();
-	const Material* get_material() const;
+	/* -1 for objects that never get shaded, like the inner parts of a
+	 * sphereflake, whose hits are reported on the flake.
+	 */
+	int get_material() const;
+	void set_material(int material);
+
+	const BBox &get_bbox() const;
 
 	virtual void calc_bbox() = 0;
+
+	/* adds the spheres the object is made of to the list, so that the
+	 * hierarchy can intersect them directly. Hits on any of them are hits
+	 * on the object. Returns false if the object isn't made of spheres.
+	 */
+	virtual bool get_spheres(std::vector<BVHSphere> *spheres) const;
+
+	/* false for objects with no finite extent, like planes. These are kept
+	 * out of the hierarchy and tested against every ray instead.
+	 */
+	virtual bool is_bounded() const;
 };
 
 #endif
@@ -22,19 +22,22 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #include <math.h>
 #include "plane.h"
 #include "config.h"
+#include "stats.h"
 
 Plane::Plane() {
 	normal = Vector3(0,1,0);
 	distance = 0;
 }
 
-Plane::Plane(const Vector3 &normal, double distance) {
+Plane::Plane(const Vector3 &normal, scalar_t distance) {
 	this->normal = normalize(normal);
 	this->distance = distance;
 }
 
 bool Plane::intersection(const Ray &ray, IntInfo* inf) const {
-	double n_dot_dir = dot(ray.dir, normal);
+	STAT_INC(STAT_PLANE_TESTS);
+
+	scalar_t n_dot_dir = dot(ray.dir, normal);
 
 	if (fabs(n_dot_dir) < EPSILON) {
 		return false;
@@ -43,13 +46,14 @@ bool Plane::intersection(const Ray &ray, IntInfo* inf) const {
 	Vector3 v = normal * distance;
 	Vector3 vorigin = v - ray.origin;
 
-	double n_dot_vo = dot(vorigin, normal);
-	double t = n_dot_vo / n_dot_dir; 
+	scalar_t n_dot_vo = dot(vorigin, normal);
+	scalar_t t = n_dot_vo / n_dot_dir; 
 
-	if (t < EPSILON || t > 1.0) {
+	if (t < ray.tmin || t > ray.tmax) {
 		return false;
 	}
 
+	STAT_INC(STAT_PLANE_HITS);
 	if (inf) {
 		inf->t = t;
 		inf->i_point = ray.origin + ray.dir * t;
@@ -66,3 +70,15 @@ void Plane::calc_bbox() {
 	bbox.max = Vector3(RAY_MAG, RAY_MAG, RAY_MAG);
 	bbox.min = -bbox.max;
 }
+
+bool Plane::is_bounded() const {
+	return false;
+}
+
+const Vector3 &Plane::get_normal() const {
+	return normal;
+}
+
+scalar_t Plane::get_distance() const {
+	return distance;
+}
@@ -28,12 +28,16 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 class Plane: public Object {
 private:
 	Vector3 normal;
-	double distance;
+	scalar_t distance;
 public:
 	Plane();
-	Plane(const Vector3 &normal, double distance);
+	Plane(const Vector3 &normal, scalar_t distance);
 	bool intersection(const Ray &ray, IntInfo* i_info) const;	
 	void calc_bbox();
+	bool is_bounded() const;
+
+	const Vector3 &get_normal() const;
+	scalar_t get_distance() const;
 };
 
 #endif
@@ -22,11 +22,92 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #ifndef RAY_H_
 #define RAY_H_
 
+#include <float.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits>
+#include "config.h"
 #include "vector.h"
 
+/* a ray, along with what the box and primitive tests need from it. Points
+ * on the ray are origin + dir * t, for t in [tmin, tmax]. Construct rays
+ * with the constructor (or set), so that invdir and sign stay in sync with
+ * dir.
+ */
 struct Ray {
 	Vector3 origin;
 	Vector3 dir;
+	Vector3 invdir;		// 1 / dir, per component
+	int sign[3];		// 1 where invdir is negative
+	scalar_t tmin, tmax;
+
+	Ray() {}
+	Ray(const Vector3 &origin, const Vector3 &dir, scalar_t tmin = EPSILON, scalar_t tmax = 1.0)
+	{
+		set(origin, dir, tmin, tmax);
+	}
+
+	inline void set(const Vector3 &origin, const Vector3 &dir, scalar_t tmin = EPSILON, scalar_t tmax = 1.0)
+	{
+		this->origin = origin;
+		this->dir = dir;
+		this->tmin = tmin;
+		this->tmax = tmax;
+
+		invdir = recip(dir);
+		sign[0] = invdir.x < 0.0;
+		sign[1] = invdir.y < 0.0;
+		sign[2] = invdir.z < 0.0;
+	}
 };
 
+// integer of the same size as the scalar type, for offset_ulps
+template <typename T> struct ScalarBits;
+template <> struct ScalarBits<float> { typedef int32_t type; };
+template <> struct ScalarBits<double> { typedef int64_t type; };
+
+// moves x by n * RAY_OFFSET_ULPS ulps, away from 0 for positive n
+template <typename T>
+inline T offset_ulps(T x, T n) {
+	typedef typename ScalarBits<T>::type Int;
+
+	Int bits;
+	memcpy(&bits, &x, sizeof x);
+
+	Int offs = (Int)(n * RAY_OFFSET_ULPS);
+	bits += x < 0 ? -offs : offs;
+
+	memcpy(&x, &bits, sizeof x);
+	return x;
+}
+
+/* moves a hit point p off its surface, to the side the normal n points to.
+ * The hit point can be off by a few ulps of its coordinates either way, so
+ * it's moved by a number of ulps, rather than a fixed distance that would
+ * be too much close to the origin and not enough far from it. Near 0 the
+ * ulps get tiny and the intersection error doesn't, so there it's a fixed
+ * distance after all. From "A Fast and Robust Method for Avoiding
+ * Self-Intersection", Carsten Waechter and Nikolaus Binder, Ray Tracing
+ * Gems, 2019.
+ */
+template <typename T>
+inline Vec3<T> offset_origin(const Vec3<T> &p, const Vec3<T> &n) {
+	// the distances of the paper are for floats, doubles get as many ulps of their own
+	const T near_origin = (T)(1.0 / 32.0);
+	const T dist = (T)(1.0 / 65536.0) * (std::numeric_limits<T>::epsilon() / FLT_EPSILON);
+
+	return Vec3<T>(fabs(p.x) < near_origin ? p.x + dist * n.x : offset_ulps(p.x, n.x),
+			fabs(p.y) < near_origin ? p.y + dist * n.y : offset_ulps(p.y, n.y),
+			fabs(p.z) < near_origin ? p.z + dist * n.z : offset_ulps(p.z, n.z));
+}
+
+/* where a secondary ray going along dir from the hit point p, on a surface
+ * with normal n, should start so that it doesn't hit that surface again.
+ * Rays from there can start at t = 0, without an EPSILON that's either too
+ * much for contacts or too little for floats.
+ */
+inline Vector3 secondary_origin(const Vector3 &p, const Vector3 &n, const Vector3 &dir) {
+	return offset_origin(p, dot(dir, n) < 0.0 ? -n : n);
+}
+
 #endif
@@ -19,13 +19,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 Author: Eleni Maria Stea <elene.mst@gmail.com>
 */
 
+#include <algorithm>
+#include <atomic>
 #include <errno.h>
 #include <inttypes.h>
 #include <math.h>
+#include <mutex>
 #include <SDL.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "camera.h"
 #include "color.h"
@@ -41,6 +47,12 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #include "sphereflake.h"
 #include "vector.h"
 #include "config.h"
+#include "tilesched.h"
+#include "image.h"
+#include "shade.h"
+#include "timer.h"
+#include "wavefront.h"
+#include "stats.h"
 
 #define DEGTORAD(x)	(M_PI * x / 180.0)
 
@@ -50,18 +62,92 @@ int height = 512;
 SDL_Surface *fbsurf;
 Scene scene;
 bool use_sdl = true;
-
-Color trace(const Ray &ray, int depth);
-Color shade(const Ray &ray, IntInfo *min_info, int depth);
-Vector3 reflect(const Vector3 &l, const Vector3 &n);
-
+int num_threads = 0;
+const char *out_fname = "out.ppm";
+bool use_aa = false;
+double aa_threshold = AA_THRESHOLD;
+const char *stats_fname;	// -stats, json file for the render statistics
+bool use_heatmap = false;
+bool use_wavefront = false;
+const char *cache_fname;	// -cache, binary scene cache, see scenecache.h
+
+struct RenderTarget {
+	uint32_t *pixels;
+	float *hdr;	// unclamped rgb floats, same layout as pixels, or null
+	float *cost;	// -heatmap, HEAT_CHANNELS floats per pixel of the whole image, or null
+	int pitch;	// in pixels
+	int ybase;	// image row of the first row of pixels
+	int step;	// trace one pixel every step pixels and fill the rest, see render_progressive
+	int prev_step;	// step of the pass before, 0 for the first one
+
+	// copy of pixels that every tile goes to once it's done, what present shows, or null
+	uint32_t *frame;
+	std::mutex frame_lock;
+
+	std::atomic<bool> cancel;
+	std::atomic<bool> finished;
+
+	std::atomic<long> num_samples;	// traced by the anti-aliasing
+	std::atomic<long> num_shared;	// of those, ones another tile traced as well, see aa_count_shared
+	std::atomic<uint32_t> *aa_edges;	// with -aa, a bit for every sample on a tile edge, or null
+
+	std::atomic<int> tiles_done;
+	int num_tiles;
+	std::mutex progr_lock;
+	int progr;
+};
+
+// the refinement passes of the interactive mode, in pixels between traced samples
+static const int pass_step[] = {16, 4, 1};
+#define NUM_PASSES	((int)(sizeof pass_step / sizeof *pass_step))
+
+/* per pixel costs recorded with -heatmap: trace time in usec, then bvh node
+ * visits and bbox tests, then primitive tests. The counts need a -DRT_STATS
+ * build and stay 0 otherwise.
+ */
+enum { HEAT_TIME, HEAT_TRAVERSAL, HEAT_PRIMITIVES, HEAT_CHANNELS };
+
+#define AA_RES	(1 << AA_MAX_DEPTH)		// anti-aliasing samples across a pixel
+
+/* the samples of a tile for the anti-aliasing, on a grid AA_RES times finer
+ * than the pixels, so that every sample is shared by all the pixels and
+ * subpixel cells it's a corner of. Each one gets traced on first use.
+ */
+struct SampleGrid {
+	int x, y;			// image position of the tile
+	int width, height;	// in samples
+	std::vector<Color> color;
+	std::vector<char> traced;
+	long num_traced;
+};
+
+bool load_scene(const std::vector<const char*> &files);
 void render();
+void render_interactive();
+void render_progressive(RenderTarget *target);
+bool render_stream(const char *fname, TileScheduler *sched, RenderTarget *target);
+void render_tile(const Tile &tile, int thread, void *cls);
+void render_tile_full(const Tile &tile, RenderTarget *target);
+void render_tile_coarse(const Tile &tile, RenderTarget *target);
+void render_tile_aa(const Tile &tile, RenderTarget *target);
+void render_tile_heat(const Tile &tile, RenderTarget *target);
+void render_tile_wavefront(const Tile &tile, RenderTarget *target);
+bool write_heatmap(const char *fname, const float *cost);
+uint32_t heat_color(double t);
+Color aa_refine(SampleGrid *grid, int gx, int gy, int size);
+Color aa_sample(SampleGrid *grid, int gx, int gy);
+void aa_init_edges(RenderTarget *target);
+void aa_count_shared(const SampleGrid &grid, RenderTarget *target);
+void print_aa_stats(const RenderTarget *target);
+void print_render_stats();
+void present(RenderTarget *target);
+bool handle_event(const SDL_Event &ev);
+uint32_t pack_color(const Color &color);
+void print_progress(int progr);
 void cleanup();
-bool write_ppm(const char *fname, uint32_t *pixels, int width, int height);
-unsigned long get_msec();
 
 int main(int argc, char **argv) {
-	bool scene_loaded = false;
+	std::vector<const char*> scene_files;
 
 	for (int i=1; i<argc; i++) {
 		// if we run with -nosdl, just render and exit
@@ -75,62 +161,120 @@ int main(int argc, char **argv) {
 				return 1;
 			}
 		}
-		else {
-			if (!scene.load(argv[i])) {
-				fprintf(stderr, "failed to load scene file: %s\n", argv[i]);
+		else if (strcmp(argv[i], "-o") == 0) {
+			if (!(out_fname = argv[++i])) {
+				fprintf(stderr, "-o should be followed by the output file name\n");
 				return 1;
 			}
-			scene_loaded = true;
+		}
+		else if (strcmp(argv[i], "-aa") == 0) {
+			use_aa = true;
+		}
+		else if (strcmp(argv[i], "-aa-threshold") == 0) {
+			i++;
+			if (!argv[i] || sscanf(argv[i], "%lf", &aa_threshold) < 1 || aa_threshold < 0.0) {
+				fprintf(stderr, "-aa-threshold should be followed by the max color difference\n");
+				return 1;
+			}
+			use_aa = true;
+		}
+		else if (strcmp(argv[i], "-stats") == 0) {
+			if (!(stats_fname = argv[++i])) {
+				fprintf(stderr, "-stats should be followed by the json file name\n");
+				return 1;
+			}
+#ifndef RT_STATS
+			fprintf(stderr, "warning: -stats needs a build with -DRT_STATS, no statistics will be written\n");
+#endif
+		}
+		else if (strcmp(argv[i], "-cutoff") == 0) {
+			i++;
+			if (!argv[i] || sscanf(argv[i], "%lf", &path_cutoff) < 1 || path_cutoff < 0.0) {
+				fprintf(stderr, "-cutoff should be followed by the least weight of a reflection to trace\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "-roulette") == 0) {
+			path_roulette = true;
+		}
+		else if (strcmp(argv[i], "-wavefront") == 0) {
+			use_wavefront = true;
+		}
+		else if (strcmp(argv[i], "-sortrays") == 0) {
+			use_wavefront = true;
+			sort_rays = true;
+		}
+		else if (strcmp(argv[i], "-heatmap") == 0) {
+			use_heatmap = true;
+		}
+		else if (strcmp(argv[i], "-threads") == 0) {
+			i++;
+			if (!argv[i] || sscanf(argv[i], "%d", &num_threads) < 1 || num_threads < 1) {
+				fprintf(stderr, "-threads should be followed by the number of threads\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "-cache") == 0) {
+			if (!(cache_fname = argv[++i])) {
+				fprintf(stderr, "-cache should be followed by the scene cache file name\n");
+				return 1;
+			}
+		}
+		else {
+			scene_files.push_back(argv[i]);
 		}
 	}
 
-	if (!scene_loaded) {
+	if (scene_files.empty()) {
 		fprintf(stderr, "must specify a scene file\n");
 		return 1;
 	}
+	if (cache_fname && scene_files.size() > 1) {
+		fprintf(stderr, "-cache works with a single scene file\n");
+		return 1;
+	}
+	if (use_wavefront && (use_aa || use_heatmap)) {
+		fprintf(stderr, "-wavefront and -sortrays can't be combined with -aa or -heatmap\n");
+		return 1;
+	}
+
+	if (!load_scene(scene_files)) {
+		return 1;
+	}
 
-	if (use_sdl) {
-		SDL_Init(SDL_INIT_VIDEO);
-	
-		if (!(fbsurf = SDL_SetVideoMode(width, height, 32, SDL_SWSURFACE))) {
-			fprintf(stderr, "set video mode failed\n");
+	if (use_heatmap) {
+		if (use_sdl) {
+			fprintf(stderr, "-heatmap only works with -nosdl\n");
+			return 1;
+		}
+		if (use_aa) {
+			fprintf(stderr, "-heatmap can't be combined with -aa\n");
 			return 1;
 		}
-		SDL_WM_SetCaption("Eleni's Raytracer", 0);
 	}
 
-	unsigned long start = get_msec();
+	// if we are not running interactively just render to the output file and quit
+	if (!use_sdl) {
+		unsigned long start = get_msec();
 
-	render();
+		render();
 
-	unsigned long msec = get_msec() - start;
-	printf("rendering completed in %lu msec\n", msec);
+		unsigned long msec = get_msec() - start;
+		printf("rendering completed in %lu msec\n", msec);
 
-	// if we are not running interactively just quit before the event loop
-	if (!use_sdl) {
 		cleanup();
 		return 0;
 	}
-	
-	SDL_Event ev;
-	bool done = false;
-
-	while (!done && SDL_WaitEvent(&ev)) {
-		switch(ev.type) {
-		case SDL_QUIT:
-			done = true;
-			break;
 
-		case SDL_KEYDOWN:
-			if(ev.key.keysym.sym == SDLK_ESCAPE) {
-				done = true;
-			}
-			break;
+	SDL_Init(SDL_INIT_VIDEO);
 
-		default:
-			break;
-		}
+	if (!(fbsurf = SDL_SetVideoMode(width, height, 32, SDL_SWSURFACE))) {
+		fprintf(stderr, "set video mode failed\n");
+		return 1;
 	}
+	SDL_WM_SetCaption("Eleni's Raytracer", 0);
+
+	render_interactive();
 
 	cleanup();
 	return 0;
@@ -140,179 +284,732 @@ void cleanup() {
 	SDL_Quit();
 }
 
+/* loads the scene files, or with -cache the scene cache if it's still good.
+ * Otherwise the cache gets written once the scene is loaded and built.
+ */
+bool load_scene(const std::vector<const char*> &files) {
+	if (cache_fname && scene.load_cache(cache_fname, files[0])) {
+		return true;
+	}
+
+	for (size_t i = 0; i < files.size(); i++) {
+		if (!scene.load(files[i])) {
+			fprintf(stderr, "failed to load scene file: %s\n", files[i]);
+			return false;
+		}
+	}
+
+	if (cache_fname && !scene.save_cache(cache_fname, files[0])) {
+		fprintf(stderr, "failed to write the scene cache: %s\n", cache_fname);
+	}
+	return true;
+}
+
+// renders the image in -nosdl mode, straight to the output file
 void render() {
-	uint32_t *fb;
+	// the tree is built lazily, make sure it's done before the workers start
+	scene.build_bbtree();
+	scene.get_camera()->set_image_size(width, height);
+
+	TileScheduler sched(num_threads > 0 ? num_threads : get_num_cpus());
+
+	RenderTarget target;
+	target.hdr = 0;
+	target.cost = use_heatmap ? new float[(size_t)width * height * HEAT_CHANNELS] : 0;
+	target.ybase = 0;
+	target.step = 1;
+	target.prev_step = 0;
+	target.frame = 0;
+	target.cancel = false;
+	target.num_samples = 0;
+	aa_init_edges(&target);
+	target.tiles_done = 0;
+	target.progr = -1;
+
+	// output the image
+	if (!render_stream(out_fname, &sched, &target)) {
+		fprintf(stderr, "failed to write image: %s\n", out_fname);
+	}
+	print_aa_stats(&target);
+	print_render_stats();
 
-	if (use_sdl) {
-		if (SDL_MUSTLOCK(fbsurf)) {
-	        SDL_LockSurface(fbsurf);
+	if (target.cost) {
+		if (!write_heatmap(out_fname, target.cost)) {
+			fprintf(stderr, "failed to write the heatmap\n");
 		}
-		fb = (uint32_t*)fbsurf->pixels;
-    } else {
-		fb = new uint32_t[width * height];
+		delete [] target.cost;
 	}
-	
-	int r = 0, g = 0, b = 0;
+	delete [] target.aa_edges;
+}
 
-	for (int y = 0; y < height; y++) {
+/* renders the image on a thread of its own, while this one keeps handling
+ * events and showing what's done so far every PRESENT_INTERVAL msec. Escape
+ * or closing the window cancels the render.
+ */
+void render_interactive() {
+	unsigned long start = get_msec();
 
-		printf(" rendering: [");
-		int progr = 100 * (y + 1) / height;
-		for(int i=0; i<100; i+=2) {
-			if(i < progr) {
-				putchar('=');
-			} else if(i - progr > 1) {
-				putchar(' ');
-			} else {
-				putchar('>');
-			}
+	scene.build_bbtree();
+	scene.get_camera()->set_image_size(width, height);
+
+	RenderTarget target;
+	target.pixels = new uint32_t[width * height];
+	target.hdr = 0;
+	target.cost = 0;
+	target.pitch = width;
+	target.ybase = 0;
+	target.step = pass_step[0];
+	target.prev_step = 0;
+	target.frame = new uint32_t[width * height];
+	target.cancel = false;
+	target.finished = false;
+	target.num_samples = 0;
+	aa_init_edges(&target);
+	target.tiles_done = 0;
+	target.progr = -1;
+
+	memset(target.pixels, 0, width * height * sizeof *target.pixels);
+	memset(target.frame, 0, width * height * sizeof *target.frame);
+
+	std::thread render_thread(render_progressive, &target);
+
+	bool done = false;
+	while (!done && !target.finished) {
+		SDL_Event ev;
+		while (SDL_PollEvent(&ev)) {
+			done = done || handle_event(ev);
 		}
-		printf("] %d%%\r", progr);
-		fflush(stdout);
 
-		for (int x = 0; x < width; x++) {
-			Ray ray = scene.get_camera()->get_primary_ray(x, y);
+		present(&target);
+		SDL_Delay(PRESENT_INTERVAL);
+	}
+
+	// on cancel, the render thread stops at the start of the next tile
+	target.cancel = true;
+	render_thread.join();
+	present(&target);
+
+	if (done) {
+		printf("\nrendering cancelled after %lu msec\n", get_msec() - start);
+	} else {
+		printf("rendering completed in %lu msec\n", get_msec() - start);
+		print_aa_stats(&target);
+		print_render_stats();
+
+		SDL_Event ev;
+		while (!done && SDL_WaitEvent(&ev)) {
+			done = handle_event(ev);
+		}
+	}
 
-			Color color = trace(ray, MAX_DEPTH); 
+	delete [] target.pixels;
+	delete [] target.frame;
+	delete [] target.aa_edges;
+}
 
-			color.x = color.x > 1.0 ? 1.0 : color.x;
-			color.y = color.y > 1.0 ? 1.0 : color.y;
-			color.z = color.z > 1.0 ? 1.0 : color.z;
+/* a quick pass that traces one pixel every pass_step[0] pixels comes first,
+ * then each pass fills in more of the image, up to a full resolution pass.
+ */
+void render_progressive(RenderTarget *target) {
+	TileScheduler sched(num_threads > 0 ? num_threads : get_num_cpus());
 
-			color = color * 255;
+	std::vector<Tile> tiles;
+	make_tiles(width, height, TILE_SIZE, &tiles);
+	target->num_tiles = (int)tiles.size() * NUM_PASSES;
 
-			r = color.x;
-			g = color.y;
-			b = color.z;
+	print_progress(0);
 
-			*fb = ((uint32_t) r << 16) | ((uint32_t) g << 8) | (uint32_t) b;
-			fb++;
-		}
+	for (int i = 0; i < NUM_PASSES && !target->cancel; i++) {
+		target->step = pass_step[i];
+		target->prev_step = i ? pass_step[i - 1] : 0;
+		sched.run(tiles, render_tile, target);
 	}
+	putchar('\n');
 
+	target->finished = true;
+}
+
+/* renders the image a band of tile rows at a time, handing every band to the
+ * image writer as soon as it's done. The writer gets on with it on its own
+ * thread while the next band renders into the other of two band buffers, so
+ * memory stays at two bands however big the image is.
+ */
+bool render_stream(const char *fname, TileScheduler *sched, RenderTarget *target) {
+	ImageWriter writer;
+	if (!writer.open(fname, image_format(fname), width, height)) {
+		return false;
+	}
+
+	// make the bands tall enough to give every thread a few tiles to work on
+	int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tile_rows = (4 * sched->get_num_threads() + tiles_x - 1) / tiles_x;
+	int band_height = tile_rows * TILE_SIZE;
+	int num_bands = (height + band_height - 1) / band_height;
+
+	size_t band_size = (size_t)width * band_height;
+	uint32_t *pixels = new uint32_t[band_size * 2];
+	float *hdr = writer.needs_hdr() ? new float[band_size * 3 * 2] : 0;
+
+	target->pitch = width;
+	target->num_tiles = tiles_x * ((height + TILE_SIZE - 1) / TILE_SIZE);
+
+	print_progress(0);
+
+	std::vector<Tile> tiles;
+	bool res = true;
+
+	for (int i = 0; i < num_bands; i++) {
+		int y = i * band_height;
+		int h = y + band_height > height ? height - y : band_height;
+
+		make_tiles(width, h, TILE_SIZE, &tiles);
+		for (size_t j = 0; j < tiles.size(); j++) {
+			tiles[j].y += y;
+		}
+
+		int buf = i & 1;
+		target->pixels = pixels + buf * band_size;
+		target->hdr = hdr ? hdr + buf * band_size * 3 : 0;
+		target->ybase = y;
+		sched->run(tiles, render_tile, target);
+
+		if (!writer.write_rows(target->pixels, target->hdr, h)) {
+			res = false;
+			break;
+		}
+	}
 	putchar('\n');
-	
-	if (use_sdl) {
-		if (SDL_MUSTLOCK(fbsurf)) {
-    	    SDL_UnlockSurface(fbsurf);
-	    }
-		SDL_Flip(fbsurf);
+
+	if (!writer.close()) {
+		res = false;
+	}
+	delete [] pixels;
+	delete [] hdr;
+	return res;
+}
+
+void render_tile(const Tile &tile, int, void *cls) {
+	RenderTarget *target = (RenderTarget*)cls;
+
+	if (target->cancel) {
+		return;
 	}
-	else {
-		// output the image
-		if (!write_ppm("out.ppm", fb - width * height, width, height)) {
-			fprintf(stderr, "failed to write image: out.ppm\n");
+
+	if (target->step > 1) {
+		render_tile_coarse(tile, target);
+	} else if (use_aa) {
+		render_tile_aa(tile, target);
+	} else if (target->cost) {
+		render_tile_heat(tile, target);
+	} else if (use_wavefront) {
+		render_tile_wavefront(tile, target);
+	} else {
+		render_tile_full(tile, target);
+	}
+
+	// the pixels of the tile are final, so the copy present shows can have them
+	if (target->frame) {
+		std::lock_guard<std::mutex> lock(target->frame_lock);
+		for (int y = tile.y; y < tile.y + tile.height; y++) {
+			size_t offs = (size_t)(y - target->ybase) * target->pitch + tile.x;
+			memcpy(target->frame + offs, target->pixels + offs, tile.width * sizeof *target->frame);
 		}
 	}
+
+	int progr = 100 * ++target->tiles_done / target->num_tiles;
+
+	// only one thread at a time gets to update the progress bar
+	std::lock_guard<std::mutex> guard(target->progr_lock);
+	if (progr > target->progr) {
+		target->progr = progr;
+		print_progress(progr);
+	}
 }
 
-Color trace(const Ray &ray, int depth) {
-	IntInfo min_info;
-	bool isect = scene.intersection(ray, &min_info);
-	if (isect) {
-		return shade(ray, &min_info, depth);
+void render_tile_full(const Tile &tile, RenderTarget *target) {
+	Ray rays[PACKET_SIZE * PACKET_SIZE];
+	IntInfo inf[PACKET_SIZE * PACKET_SIZE];
+	bool hits[PACKET_SIZE * PACKET_SIZE];
+
+	int tile_xend = tile.x + tile.width;
+	int tile_yend = tile.y + tile.height;
+
+	// trace the primary rays of each block of pixels together
+	for (int py = tile.y; py < tile_yend; py += PACKET_SIZE) {
+		int yend = py + PACKET_SIZE < tile_yend ? py + PACKET_SIZE : tile_yend;
+
+		for (int px = tile.x; px < tile_xend; px += PACKET_SIZE) {
+			int xend = px + PACKET_SIZE < tile_xend ? px + PACKET_SIZE : tile_xend;
+
+			int num_rays = (xend - px) * (yend - py);
+			scene.get_camera()->get_primary_rays(px, py, xend - px, yend - py, rays);
+
+			scene.intersection(rays, num_rays, inf, hits);
+			STAT_ADD(STAT_PRIMARY_RAYS, num_rays);
+
+			int i = 0;
+			for (int y = py; y < yend; y++) {
+				size_t offs = (size_t)(y - target->ybase) * target->pitch + px;
+				uint32_t *fb = target->pixels + offs;
+				float *hdr = target->hdr ? target->hdr + offs * 3 : 0;
+
+				for (int x = px; x < xend; x++) {
+					Color color = hits[i] ? shade(rays[i], inf + i, MAX_DEPTH) : Color(0, 0, 0);
+					*fb++ = pack_color(color);
+					if (hdr) {
+						*hdr++ = color.x;
+						*hdr++ = color.y;
+						*hdr++ = color.z;
+					}
+					i++;
+				}
+			}
+		}
 	}
+}
+
+void render_tile_wavefront(const Tile &tile, RenderTarget *target) {
+	// every thread keeps its own, so that the queues only get allocated once
+	static thread_local Wavefront wavefront;
 
-	return Color(0, 0, 0);
+	const Color *color = wavefront.render(tile.x, tile.y, tile.width, tile.height);
+
+	for (int y = tile.y; y < tile.y + tile.height; y++) {
+		size_t offs = (size_t)(y - target->ybase) * target->pitch + tile.x;
+		uint32_t *fb = target->pixels + offs;
+		float *hdr = target->hdr ? target->hdr + offs * 3 : 0;
+
+		for (int x = 0; x < tile.width; x++) {
+			*fb++ = pack_color(*color);
+			if (hdr) {
+				*hdr++ = color->x;
+				*hdr++ = color->y;
+				*hdr++ = color->z;
+			}
+			color++;
+		}
+	}
 }
 
-Color shade(const Ray &ray, IntInfo* min_info, int depth) {
+/* traces one pixel every target->step pixels and fills the step x step block
+ * below and right of it with its color. Pixels that the previous pass traced
+ * already just get their blocks shrunk.
+ */
+void render_tile_coarse(const Tile &tile, RenderTarget *target) {
+	int step = target->step;
+	int tile_xend = tile.x + tile.width;
+	int tile_yend = tile.y + tile.height;
 
-	if (!depth) 
-		return Color(0, 0, 0);
+	int y0 = (tile.y + step - 1) / step * step;
+	int x0 = (tile.x + step - 1) / step * step;
 
-	Vector3 n = min_info->normal;
-	Vector3 p = min_info->i_point;
-	Vector3 v = normalize(ray.origin - p);
+	for (int y = y0; y < tile_yend; y += step) {
+		int yend = y + step < tile_yend ? y + step : tile_yend;
 
-	const Material *mat = min_info->object->get_material();
-	Color color = scene.get_ambient() * mat->kd;
-	
-	for (int i = 0; i < (int)scene.lights.size(); i++) {
-		Light *light = scene.lights[i];
+		for (int x = x0; x < tile_xend; x += step) {
+			int xend = x + step < tile_xend ? x + step : tile_xend;
+			uint32_t *fb = target->pixels + (y - target->ybase) * target->pitch + x;
 
-		Ray sray;
-		sray.origin = p;
-		sray.dir = light->position - p;
+			uint32_t pix;
+			if (target->prev_step && x % target->prev_step == 0 && y % target->prev_step == 0) {
+				pix = *fb;
+			} else {
+				pix = pack_color(trace(scene.get_camera()->get_primary_ray(x, y), MAX_DEPTH));
+				STAT_INC(STAT_PRIMARY_RAYS);
+			}
 
-		if (!scene.intersection(sray, 0)) {
-			Vector3 l = normalize(sray.dir);
-			Vector3 lr = reflect(l, n); 
+			for (int i = y; i < yend; i++) {
+				for (int j = 0; j < xend - x; j++) {
+					fb[j] = pix;
+				}
+				fb += target->pitch;
+			}
+		}
+	}
+}
 
-			double d = dot(n, l);
-			if (d < 0.0) {
-				d = 0;
+/* adaptive anti-aliasing: every pixel gets the average of its 4 corners,
+ * unless they differ by more than aa_threshold, in which case it gets split
+ * in 4 and the same goes for each quarter, down to AA_MAX_DEPTH levels.
+ */
+void render_tile_aa(const Tile &tile, RenderTarget *target) {
+	SampleGrid grid;
+	grid.x = tile.x;
+	grid.y = tile.y;
+	grid.width = tile.width * AA_RES + 1;
+	grid.height = tile.height * AA_RES + 1;
+	grid.color.resize(grid.width * grid.height);
+	grid.traced.assign(grid.width * grid.height, 0);
+	grid.num_traced = 0;
+
+	// pixel corners are always needed, trace them in packets
+	Ray rays[PACKET_SIZE * PACKET_SIZE];
+	IntInfo inf[PACKET_SIZE * PACKET_SIZE];
+	bool hits[PACKET_SIZE * PACKET_SIZE];
+
+	for (int py = 0; py <= tile.height; py += PACKET_SIZE) {
+		int yend = py + PACKET_SIZE <= tile.height ? py + PACKET_SIZE : tile.height + 1;
+
+		for (int px = 0; px <= tile.width; px += PACKET_SIZE) {
+			int xend = px + PACKET_SIZE <= tile.width ? px + PACKET_SIZE : tile.width + 1;
+
+			int num_rays = (xend - px) * (yend - py);
+			scene.get_camera()->get_primary_rays(tile.x + px, tile.y + py, xend - px, yend - py, rays);
+
+			scene.intersection(rays, num_rays, inf, hits);
+			STAT_ADD(STAT_PRIMARY_RAYS, num_rays);
+
+			int i = 0;
+			for (int y = py; y < yend; y++) {
+				for (int x = px; x < xend; x++) {
+					int idx = y * AA_RES * grid.width + x * AA_RES;
+					grid.color[idx] = hits[i] ? shade(rays[i], inf + i, MAX_DEPTH) : Color(0, 0, 0);
+					grid.traced[idx] = 1;
+					i++;
+				}
 			}
+			grid.num_traced += num_rays;
+		}
+	}
 
-			double lrdotv = dot(lr, v);
-			if(lrdotv < 0.0) {
-				lrdotv = 0.0;
+	for (int y = 0; y < tile.height; y++) {
+		size_t offs = (size_t)(tile.y + y - target->ybase) * target->pitch + tile.x;
+		uint32_t *fb = target->pixels + offs;
+		float *hdr = target->hdr ? target->hdr + offs * 3 : 0;
+
+		for (int x = 0; x < tile.width; x++) {
+			Color color = aa_refine(&grid, x * AA_RES, y * AA_RES, AA_RES);
+			*fb++ = pack_color(color);
+			if (hdr) {
+				*hdr++ = color.x;
+				*hdr++ = color.y;
+				*hdr++ = color.z;
 			}
+		}
+	}
 
-			double s = pow(lrdotv, mat->specexp);
-			color = color + (d * mat->kd + s * mat->ks) * light->color;
+	target->num_samples += grid.num_traced;
+	aa_count_shared(grid, target);
+}
+
+// average color of the size x size cell of the sample grid at gx, gy
+Color aa_refine(SampleGrid *grid, int gx, int gy, int size) {
+	Color c[4] = {
+		aa_sample(grid, gx, gy),
+		aa_sample(grid, gx + size, gy),
+		aa_sample(grid, gx, gy + size),
+		aa_sample(grid, gx + size, gy + size)
+	};
+
+	if (size > 1) {
+		// compare the colors as they will be displayed
+		Color one(1, 1, 1);
+		Color lo = vmin(c[0], one), hi = lo;
+		for (int i = 1; i < 4; i++) {
+			lo = vmin(lo, vmin(c[i], one));
+			hi = vmax(hi, vmin(c[i], one));
+		}
+		Color diff = hi - lo;
 
+		if (diff.x > aa_threshold || diff.y > aa_threshold || diff.z > aa_threshold) {
+			int half = size / 2;
+			return (aa_refine(grid, gx, gy, half) + aa_refine(grid, gx + half, gy, half) +
+					aa_refine(grid, gx, gy + half, half) + aa_refine(grid, gx + half, gy + half, half)) * 0.25;
 		}
 	}
+	return (c[0] + c[1] + c[2] + c[3]) * 0.25;
+}
+
+Color aa_sample(SampleGrid *grid, int gx, int gy) {
+	int idx = gy * grid->width + gx;
+
+	if (!grid->traced[idx]) {
+		double x = grid->x + (double)gx / AA_RES;
+		double y = grid->y + (double)gy / AA_RES;
+
+		grid->color[idx] = trace(scene.get_camera()->get_sample_ray(x, y), MAX_DEPTH);
+		STAT_INC(STAT_PRIMARY_RAYS);
+		grid->traced[idx] = 1;
+		grid->num_traced++;
+	}
+	return grid->color[idx];
+}
 
-	if (mat->kr > 0.0) {
-		Ray refray;
-		refray.origin = p;
-		refray.dir = reflect(-ray.dir, n);
-		color = color + mat->kr * trace(refray, depth-1) * mat->ks;
+/* traces the pixels one by one instead of in packets, so that the cost of
+ * each can be told apart, and records it in target->cost.
+ */
+void render_tile_heat(const Tile &tile, RenderTarget *target) {
+	for (int y = tile.y; y < tile.y + tile.height; y++) {
+		size_t offs = (size_t)(y - target->ybase) * target->pitch + tile.x;
+		uint32_t *fb = target->pixels + offs;
+		float *hdr = target->hdr ? target->hdr + offs * 3 : 0;
+		float *cost = target->cost + ((size_t)y * width + tile.x) * HEAT_CHANNELS;
+
+		for (int x = tile.x; x < tile.x + tile.width; x++) {
+#ifdef RT_STATS
+			RenderStats prev = thread_stats;
+#endif
+			unsigned long long start = get_nsec();
+
+			Color color = trace(scene.get_camera()->get_primary_ray(x, y), MAX_DEPTH);
+			STAT_INC(STAT_PRIMARY_RAYS);
+
+			cost[HEAT_TIME] = (float)((get_nsec() - start) / 1000.0);
+#ifdef RT_STATS
+			const uint64_t *c = thread_stats.count;
+			const uint64_t *pc = prev.count;
+			cost[HEAT_TRAVERSAL] = (float)(c[STAT_NODE_VISITS] - pc[STAT_NODE_VISITS] +
+					c[STAT_BBOX_TESTS] - pc[STAT_BBOX_TESTS]);
+			cost[HEAT_PRIMITIVES] = (float)(c[STAT_PACK_TESTS] - pc[STAT_PACK_TESTS] +
+					c[STAT_SPHERE_TESTS] - pc[STAT_SPHERE_TESTS] + c[STAT_PLANE_TESTS] -
+					pc[STAT_PLANE_TESTS] + c[STAT_SFLAKE_TESTS] - pc[STAT_SFLAKE_TESTS]);
+#else
+			cost[HEAT_TRAVERSAL] = cost[HEAT_PRIMITIVES] = 0.0f;
+#endif
+			cost += HEAT_CHANNELS;
+
+			*fb++ = pack_color(color);
+			if (hdr) {
+				*hdr++ = color.x;
+				*hdr++ = color.y;
+				*hdr++ = color.z;
+			}
+		}
 	}
+}
 
-	return color;
+/* the tiles don't share their samples, the ones on an edge between two
+ * tiles get traced by both if both need them. To tell how many rays that
+ * costs, every tile marks the samples it traced on its edges in a bitmap of
+ * all the edges inside the image, and counts the ones a neighbour marked
+ * before it.
+ */
+void aa_init_edges(RenderTarget *target) {
+	target->num_shared = 0;
+	target->aa_edges = 0;
+
+	if (use_aa) {
+		int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+		int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+		size_t bits = (size_t)(tiles_x - 1) * (height * AA_RES + 1) +
+			(size_t)(tiles_y - 1) * (width * AA_RES + 1);
+
+		target->aa_edges = new std::atomic<uint32_t>[bits / 32 + 1]();
+	}
 }
 
-bool write_ppm(const char *fname, uint32_t *pixels, int width, int height) {
-	FILE *fp;
+// marks a sample at ix, iy of the image sample grid, true if it was marked already
+static bool aa_mark_edge(RenderTarget *target, int ix, int iy) {
+	int edge = TILE_SIZE * AA_RES;
+	size_t bit;
+
+	// on a vertical edge, or else on a horizontal one
+	if (ix % edge == 0 && ix > 0 && ix < width * AA_RES) {
+		bit = (size_t)(ix / edge - 1) * (height * AA_RES + 1) + iy;
+	} else {
+		int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+		bit = (size_t)(tiles_x - 1) * (height * AA_RES + 1) +
+			(size_t)(iy / edge - 1) * (width * AA_RES + 1) + ix;
+	}
+
+	uint32_t mask = 1u << (bit % 32);
+	return target->aa_edges[bit / 32].fetch_or(mask) & mask;
+}
 
-	if(!(fp = fopen(fname, "wb"))) {
-		return false;
+void aa_count_shared(const SampleGrid &grid, RenderTarget *target) {
+	if (!target->aa_edges) {
+		return;
 	}
 
-	fprintf(fp, "P6\n%d %d\n255\n", width, height);
+	int ix = grid.x * AA_RES, iy = grid.y * AA_RES;
+	int last_x = grid.width - 1, last_y = grid.height - 1;
+	bool left = grid.x > 0, right = ix + last_x < width * AA_RES;
+	bool top = grid.y > 0, bottom = iy + last_y < height * AA_RES;
+	long shared = 0;
 
-	int imgsz = width * height;
-	for(int i=0; i<imgsz; i++) {
-		uint32_t pix = *pixels++;
-		int r = (pix >> 16) & 0xff;
-		int g = (pix >> 8) & 0xff;
-		int b = pix & 0xff;
+	for (int gy = 0; gy < grid.height; gy++) {
+		if (left && grid.traced[gy * grid.width]) {
+			shared += aa_mark_edge(target, ix, iy + gy);
+		}
+		if (right && grid.traced[gy * grid.width + last_x]) {
+			shared += aa_mark_edge(target, ix + last_x, iy + gy);
+		}
+	}
 
-		fputc(r, fp);
-		fputc(g, fp);
-		fputc(b, fp);
+	// the corners went with the vertical edges already
+	for (int gx = left ? 1 : 0; gx < (right ? last_x : grid.width); gx++) {
+		if (top && grid.traced[gx]) {
+			shared += aa_mark_edge(target, ix + gx, iy);
+		}
+		if (bottom && grid.traced[last_y * grid.width + gx]) {
+			shared += aa_mark_edge(target, ix + gx, iy + last_y);
+		}
 	}
-	fclose(fp);
-	return true;
+	target->num_shared += shared;
 }
 
-#if defined(unix) || defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
-#include <sys/time.h>
+void print_aa_stats(const RenderTarget *target) {
+	if (use_aa) {
+		double num_pixels = (double)width * height;
+		printf("anti-aliasing: %.2f samples per pixel, of which %.2f retraced on tile edges\n",
+				target->num_samples / num_pixels, target->num_shared / num_pixels);
+	}
+}
 
-unsigned long get_msec() {
-	struct timeval tv;
-	static struct timeval tv0;
+/* writes the costs recorded by -heatmap next to the image file: as raw
+ * floats to name.heat.pfm, and false colored to name.heat.ppm. The colors
+ * show the number of intersection tests in -DRT_STATS builds and the time
+ * otherwise, scaled so that the costliest 1% of the pixels come out white.
+ */
+bool write_heatmap(const char *fname, const float *cost) {
+	std::string base = fname;
+	size_t dot = base.find_last_of('.');
+	if (dot != std::string::npos && base.find_first_of("/\\", dot) == std::string::npos) {
+		base.erase(dot);
+	}
+	std::string raw_fname = base + ".heat.pfm";
+	std::string img_fname = base + ".heat.ppm";
 
-	gettimeofday(&tv, 0);
+	size_t num_pixels = (size_t)width * height;
 
-	if(tv0.tv_sec == 0 && tv0.tv_usec == 0) {
-		tv0 = tv;
-		return 0;
+	std::vector<float> value(num_pixels);
+	for (size_t i = 0; i < num_pixels; i++) {
+		const float *c = cost + i * HEAT_CHANNELS;
+#ifdef RT_STATS
+		value[i] = c[HEAT_TRAVERSAL] + c[HEAT_PRIMITIVES];
+#else
+		value[i] = c[HEAT_TIME];
+#endif
+	}
+
+	std::vector<float> sorted = value;
+	std::vector<float>::iterator top = sorted.begin() + num_pixels * 99 / 100;
+	std::nth_element(sorted.begin(), top, sorted.end());
+	float max_value = *top > 0.0f ? *top : 1.0f;
+
+	std::vector<uint32_t> pixels(num_pixels);
+	for (size_t i = 0; i < num_pixels; i++) {
+		pixels[i] = heat_color(value[i] / max_value);
+	}
+
+	ImageWriter writer;
+	if (!writer.open(raw_fname.c_str(), IMG_PFM, width, height) ||
+			!writer.write_rows(0, cost, height) || !writer.close()) {
+		return false;
+	}
+	if (!writer.open(img_fname.c_str(), IMG_PPM, width, height) ||
+			!writer.write_rows(&pixels[0], 0, height) || !writer.close()) {
+		return false;
 	}
 
-	return (tv.tv_sec - tv0.tv_sec) * 1000 + (tv.tv_usec - tv0.tv_usec) / 1000;
+#ifdef RT_STATS
+	printf("heatmap: %s, %s (white: %.0f tests per pixel)\n", img_fname.c_str(), raw_fname.c_str(), max_value);
+#else
+	printf("heatmap: %s, %s (white: %.2f usec per pixel)\n", img_fname.c_str(), raw_fname.c_str(), max_value);
+#endif
+	return true;
 }
 
-#elif defined(WIN32) || defined(__WIN32__)
-#include <windows.h>
+// maps 0 to 1 through blue, cyan, green, yellow and red to white
+uint32_t heat_color(double t) {
+	static const Color ramp[] = {
+		Color(0, 0, 0.5), Color(0, 0, 1), Color(0, 1, 1), Color(0, 1, 0),
+		Color(1, 1, 0), Color(1, 0, 0), Color(1, 1, 1)
+	};
+	static const int last = (int)(sizeof ramp / sizeof *ramp) - 1;
+
+	if (t <= 0.0) {
+		return pack_color(ramp[0]);
+	}
+	if (t >= 1.0) {
+		return pack_color(ramp[last]);
+	}
 
-unsigned long get_msec() {
-	return timeGetTime();
+	double pos = t * last;
+	int i = (int)pos;
+	double frac = pos - i;
+	return pack_color(ramp[i] * (1.0 - frac) + ramp[i + 1] * frac);
 }
 
-#else
-#error "unsupported platform"
+// prints the counters gathered by the render threads, which must be done by now
+void print_render_stats() {
+#ifdef RT_STATS
+	RenderStats stats;
+	stats_collect(&stats);
+	stats_print(stdout, &stats);
+
+	if (stats_fname && !stats_write_json(stats_fname, &stats)) {
+		fprintf(stderr, "failed to write render statistics: %s\n", stats_fname);
+	}
 #endif
+}
+
+/* copies the frame to the window. That's the tiles finished so far, the
+ * pixels of the ones in progress are still being written.
+ */
+void present(RenderTarget *target) {
+	std::lock_guard<std::mutex> lock(target->frame_lock);
+
+	if (SDL_MUSTLOCK(fbsurf)) {
+		SDL_LockSurface(fbsurf);
+	}
+
+	for (int i = 0; i < height; i++) {
+		uint32_t *dest = (uint32_t*)((char*)fbsurf->pixels + i * fbsurf->pitch);
+		memcpy(dest, target->frame + i * target->pitch, width * sizeof *dest);
+	}
+
+	if (SDL_MUSTLOCK(fbsurf)) {
+		SDL_UnlockSurface(fbsurf);
+	}
+	SDL_Flip(fbsurf);
+}
+
+// returns true for the events that should end the program
+bool handle_event(const SDL_Event &ev) {
+	switch(ev.type) {
+	case SDL_QUIT:
+		return true;
+
+	case SDL_KEYDOWN:
+		if(ev.key.keysym.sym == SDLK_ESCAPE) {
+			return true;
+		}
+		break;
+
+	default:
+		break;
+	}
+	return false;
+}
+
+uint32_t pack_color(const Color &col) {
+	Color color = col;
+
+	color.x = color.x > 1.0 ? 1.0 : color.x;
+	color.y = color.y > 1.0 ? 1.0 : color.y;
+	color.z = color.z > 1.0 ? 1.0 : color.z;
+
+	color = color * 255;
+
+	int r = color.x;
+	int g = color.y;
+	int b = color.z;
+
+	return ((uint32_t) r << 16) | ((uint32_t) g << 8) | (uint32_t) b;
+}
+
+void print_progress(int progr) {
+	printf(" rendering: [");
+	for(int i=0; i<100; i+=2) {
+		if(i < progr) {
+			putchar('=');
+		} else if(i - progr > 1) {
+			putchar(' ');
+		} else {
+			putchar('>');
+		}
+	}
+	printf("] %d%%\r", progr);
+	fflush(stdout);
+}
@@ -20,8 +20,13 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 */
 
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <math.h>
 #include <float.h>
+#include <thread>
 #include "config.h"
 #include "scene.h"
 #include "sphere.h"
@@ -29,124 +34,400 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #include "sphereflake.h"
 #include "camera.h"
 #include "light.h"
-
-static Sphere *load_sphere(const char *line);
-static Plane *load_plane(const char *line);
-static SphereFlake *load_sphflake(const char *line);
-static Camera *load_camera(const char *line);
-static Light *load_light(const char *line);
+#include "bvh.h"
+#include "timer.h"
+#include "scenecache.h"
+#include "mappedfile.h"
+#include "tilesched.h"
+
+// a line that didn't parse, line counts from the start of its chunk
+struct ParseError {
+	int line;
+	const char *text;
+	int len;
+};
+
+// a piece of the scene file and what came out of it
+struct ParseChunk {
+	const char *start, *end;
+	int num_lines;
+	std::vector<Object*> objects;
+	std::vector<Material> materials;	// of each of the objects
+	std::vector<Light*> lights;
+	Camera *cam;
+	std::vector<ParseError> errors;
+
+	// where the objects are made, the scene takes them over after parsing
+	Arena sphere_mem, plane_mem, sflake_mem;
+};
+
+static bool read_file(FILE *fp, std::vector<char> *data);
+static void parse_chunk(ParseChunk *chunk);
+static Sphere *load_sphere(const char *line, const char *end, ParseChunk *chunk, Material *mat);
+static Plane *load_plane(const char *line, const char *end, ParseChunk *chunk, Material *mat);
+static SphereFlake *load_sphflake(const char *line, const char *end, ParseChunk *chunk, Material *mat);
+static Camera *load_camera(const char *line, const char *end);
+static Light *load_light(const char *line, const char *end);
+static int scan_line(const char *line, const char *end, const char *fmt, ...);
+static bool parse_float(const char **ptr, const char *end, float *res);
+static bool parse_int(const char **ptr, const char *end, int *res);
 
 Scene::Scene(){
 	cam = 0;
 	ambient = Color(0, 0, 0);
-	bbroot = 0;
+	bvh = 0;
+	cache = 0;
+	cache_objects = 0;
 }
 
+/* the objects go with their arenas, a few big blocks, however many of
+ * them there are.
+ */
 Scene::~Scene() {
-	for (int i = 0; i < (int) objects.size(); i++) {
-		delete objects[i];
-	}
-
 	for (int i = 0; i < (int) lights.size(); i++) {
 		delete lights[i];
 	}
 
-	if (bbroot) {
-		delete bbroot;
-	}
+	delete bvh;
+	delete [] cache_objects;
+	delete cache;
 }
 
 bool Scene::load(const char *fname) {
-	FILE *fp;
+	MappedFile file;
 
-	if(!(fp = fopen(fname, "r"))) {
+	if (file.open(fname)) {
+		load_data((const char*)file.get_data(), file.get_size(), fname);
+		return true;
+	}
+
+	// not something that can be mapped, like an empty file or a pipe
+	FILE *fp;
+	if(!(fp = fopen(fname, "rb"))) {
 		return false;
 	}
 
-	bool res = load(fp);
+	std::vector<char> data;
+	bool res = read_file(fp, &data);
 	fclose(fp);
+
+	if(res) {
+		load_data(data.data(), data.size(), fname);
+	}
 	return res;
 }
 
-#define ERROR(l, n)	\
-	fprintf(stderr, "error in line %d: \"%s\", ignoring.\n", n, l)
-
 bool Scene::load(FILE *fp) {
-	char line[1024];
+	std::vector<char> data;
+	if(!read_file(fp, &data)) {
+		return false;
+	}
+
+	load_data(data.data(), data.size(), "scene");
+	return true;
+}
+
+/* parses the scene in pieces of at least PARSE_CHUNK_SIZE bytes, cut at line
+ * ends, one thread each. Their results get added in file order, so that
+ * the scene comes out the same however many threads there are.
+ */
+void Scene::load_data(const char *data, size_t size, const char *name) {
+	unsigned long long start = get_nsec();
+
+	int num_chunks = (int)(size / PARSE_CHUNK_SIZE);
+	int num_cpus = get_num_cpus();
+	if(num_chunks > num_cpus) {
+		num_chunks = num_cpus;
+	}
+	if(num_chunks < 1) {
+		num_chunks = 1;
+	}
+
+	std::vector<ParseChunk> chunks(num_chunks);
+	const char *end = data + size;
+	const char *ptr = data;
+
+	for(int i = 0; i < num_chunks; i++) {
+		const char *cend = i == num_chunks - 1 ? end : data + size / num_chunks * (i + 1);
+		if(cend < ptr) {
+			cend = ptr;
+		}
+		while(cend < end && cend[-1] != '\n') {
+			cend++;
+		}
+
+		chunks[i].start = ptr;
+		chunks[i].end = cend;
+		ptr = cend;
+	}
+
+	std::vector<std::thread> threads;
+	for(int i = 1; i < num_chunks; i++) {
+		threads.push_back(std::thread(parse_chunk, &chunks[i]));
+	}
+	parse_chunk(&chunks[0]);
+	for(size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+
+	int lnum = 0;
+	for(int i = 0; i < num_chunks; i++) {
+		ParseChunk *chunk = &chunks[i];
+
+		for(size_t j = 0; j < chunk->errors.size(); j++) {
+			const ParseError &err = chunk->errors[j];
+			fprintf(stderr, "error in line %d: \"%.*s\", ignoring.\n", lnum + err.line, err.len, err.text);
+		}
+		lnum += chunk->num_lines;
+
+		for(size_t j = 0; j < chunk->objects.size(); j++) {
+			chunk->objects[j]->set_material(add_material(chunk->materials[j]));
+		}
+		objects.insert(objects.end(), chunk->objects.begin(), chunk->objects.end());
+		sphere_mem.take(&chunk->sphere_mem);
+		plane_mem.take(&chunk->plane_mem);
+		sflake_mem.take(&chunk->sflake_mem);
+
+		lights.insert(lights.end(), chunk->lights.begin(), chunk->lights.end());
+		if(chunk->cam) {
+			set_camera(chunk->cam);
+		}
+	}
+
+	double sec = (get_nsec() - start) / 1e9;
+	double mb = size / (1024.0 * 1024.0);
+	printf("parsed %s: %d lines, %.1f MB in %.0f msec, %.1f MB/s (%d threads)\n", name, lnum, mb,
+			sec * 1000.0, sec > 0.0 ? mb / sec : 0.0, num_chunks);
+}
+
+static bool read_file(FILE *fp, std::vector<char> *data) {
+	char buf[65536];
+	size_t sz;
+
+	while((sz = fread(buf, 1, sizeof buf, fp)) > 0) {
+		data->insert(data->end(), buf, buf + sz);
+	}
+	return !ferror(fp);
+}
+
+static void parse_chunk(ParseChunk *chunk) {
 	Sphere *sph;
 	SphereFlake *sflake;
 	Plane *plane;
 	Camera *cam;
 	Light *lt;
+	Material mat;
 
-	int lnum = 0;
-	while(fgets(line, sizeof line, fp)) {
-		lnum++;
+	chunk->num_lines = 0;
+	chunk->cam = 0;
 
-		if(line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
+	const char *line = chunk->start;
+	while(line < chunk->end) {
+		const char *end = (const char*)memchr(line, '\n', chunk->end - line);
+		if(!end) {
+			end = chunk->end;
+		}
+		chunk->num_lines++;
+
+		if(line == end || line[0] == '#' || line[0] == '\r') {
+			line = end + 1;
 			continue;
 		}
 
+		bool ok = true;
 		switch(line[0]) {
 		case 's':
-			if((sph = load_sphere(line))) {
-				add_object(sph);
-			} else {
-				ERROR(line, lnum);
+			if((ok = (sph = load_sphere(line, end, chunk, &mat)))) {
+				chunk->objects.push_back(sph);
+				chunk->materials.push_back(mat);
 			}
 			break;
 
 		case 'p':
-			if((plane = load_plane(line))) {
-				add_object(plane);
-			} else {
-				ERROR(line, lnum);
+			if((ok = (plane = load_plane(line, end, chunk, &mat)))) {
+				chunk->objects.push_back(plane);
+				chunk->materials.push_back(mat);
 			}
 			break;
 
 		case 'f':
-			if((sflake = load_sphflake(line))) {
-				add_object(sflake);
-			} else {
-				ERROR(line, lnum);
+			if((ok = (sflake = load_sphflake(line, end, chunk, &mat)))) {
+				chunk->objects.push_back(sflake);
+				chunk->materials.push_back(mat);
 			}
 			break;
 
 		case 'l':
-			if((lt = load_light(line))) {
-				lights.push_back(lt);
-			} else {
-				ERROR(line, lnum);
+			if((ok = (lt = load_light(line, end)))) {
+				chunk->lights.push_back(lt);
 			}
 			break;
 
 		case 'c':
-			if((cam = load_camera(line))) {
-				set_camera(cam);
-			} else {
-				ERROR(line, lnum);
+			if((ok = (cam = load_camera(line, end)))) {
+				// the last camera of the file is the one that counts
+				delete chunk->cam;
+				chunk->cam = cam;
 			}
 			break;
 
 		default:
-			ERROR(line, lnum);
+			ok = false;
 		}
+
+		if(!ok) {
+			ParseError err;
+			err.line = chunk->num_lines;
+			err.text = line;
+			err.len = (int)(end - line);
+			if(err.len && line[err.len - 1] == '\r') {
+				err.len--;
+			}
+			chunk->errors.push_back(err);
+		}
+		line = end + 1;
 	}
+}
 
-	return true;
+Sphere *Scene::add_sphere(const Vector3 &center, scalar_t radius, int material) {
+	Sphere *sph = sphere_mem.create<Sphere>(center, radius);
+	sph->set_material(material);
+	objects.push_back(sph);
+	return sph;
 }
 
+Plane *Scene::add_plane(const Vector3 &normal, scalar_t distance, int material) {
+	Plane *plane = plane_mem.create<Plane>(normal, distance);
+	plane->set_material(material);
+	objects.push_back(plane);
+	return plane;
+}
+
+SphereFlake *Scene::add_sphereflake(const Vector3 &center, scalar_t radius, int iter, int material) {
+	SphereFlake *sflake = create_sflake(center, radius, iter, &sflake_mem, &sphere_mem);
+	if(sflake) {
+		sflake->set_material(material);
+		objects.push_back(sflake);
+	}
+	return sflake;
+}
 
 void Scene::add_object(Object* object) {
 	objects.push_back(object);
 }
 
+/* materials are compared by their bytes, parsing the same text always
+ * gives the same bytes.
+ */
+size_t Scene::MaterialHash::operator()(const Material &mat) const {
+	uint64_t words[sizeof mat / sizeof(uint64_t)];
+	memcpy(words, &mat, sizeof words);
+
+	uint64_t h = 0;
+	for(size_t i = 0; i < sizeof words / sizeof *words; i++) {
+		h = (h ^ words[i]) * 0x100000001b3ull;
+		h ^= h >> 29;
+	}
+	return (size_t)h;
+}
+
+bool Scene::MaterialEqual::operator()(const Material &a, const Material &b) const {
+	return memcmp(&a, &b, sizeof a) == 0;
+}
+
+int Scene::add_material(const Material &mat) {
+	std::pair<std::unordered_map<Material, int, MaterialHash, MaterialEqual>::iterator, bool> res =
+		material_index.insert(std::make_pair(mat, (int)materials.size()));
+	if(res.second) {
+		materials.push_back(mat);
+	}
+	return res.first->second;
+}
+
+const Material *Scene::get_material(int idx) const {
+	return &materials[idx];
+}
+
+int Scene::get_material_count() const {
+	return (int)materials.size();
+}
+
 bool Scene::intersection(const Ray &ray, IntInfo* inter) {
-	if(!bbroot) {
+	if(!bvh) {
 		build_bbtree();
 	}
 
-	return bbroot->intersection(ray, inter);
+	if(unbounded.empty()) {
+		return bvh->intersection(ray, inter);
+	}
+
+	/* test the unbounded objects first, the closest of their hits cuts the
+	 * ray short for the search in the hierarchy.
+	 */
+	IntInfo minsect, tmp;
+	minsect.object = 0;
+	Ray r = ray;
+
+	for(size_t i = 0; i < unbounded.size(); i++) {
+		if(unbounded[i]->intersection(r, &tmp)) {
+			minsect = tmp;
+			r.tmax = tmp.t;
+		}
+	}
+
+	if(bvh->intersection(r, &tmp)) {
+		minsect = tmp;
+	}
+
+	if(!minsect.object) {
+		return false;
+	}
+	if(inter) {
+		*inter = minsect;
+	}
+	return true;
+}
+
+void Scene::intersection(const Ray *rays, int num_rays, IntInfo *inter, bool *hits) {
+	if(!bvh) {
+		build_bbtree();
+	}
+
+	bvh->intersection(rays, num_rays, inter, hits);
+
+	if(unbounded.empty()) {
+		return;
+	}
+
+	// keep whichever of the packet hit and the unbounded objects is closest
+	for(int i = 0; i < num_rays; i++) {
+		Ray r = rays[i];
+		if(hits[i]) {
+			r.tmax = inter[i].t;
+		}
+
+		IntInfo tmp;
+		for(size_t j = 0; j < unbounded.size(); j++) {
+			if(unbounded[j]->intersection(r, &tmp) && (!hits[i] || tmp.t < inter[i].t)) {
+				inter[i] = tmp;
+				hits[i] = true;
+				r.tmax = tmp.t;
+			}
+		}
+	}
+}
+
+bool Scene::occluded(const Ray &ray) {
+	if(!bvh) {
+		build_bbtree();
+	}
+
+	for(size_t i = 0; i < unbounded.size(); i++) {
+		if(unbounded[i]->intersection(ray, 0)) {
+			return true;
+		}
+	}
+	return bvh->occluded(ray);
 }
 
 void Scene::set_camera(Camera* camera) {
@@ -166,85 +447,91 @@ Color Scene::get_ambient() {
 }
 
 void Scene::build_bbtree() {
-	/* since we have infinite planes make the root bounding box *LARGE*
-	 * (not quite correct but works for our purposes, the ray
-	 * doesn't go to infinity anyway).
-	 */
-	Vector3 max(RAY_MAG, RAY_MAG, RAY_MAG);
-	Vector3 min = -max;
+	if (bvh) {
+		return;
+	}
+
+	unsigned long start = get_msec();
 
-	bbroot = new BBoxNode(BBox(min, max));
+	/* objects without a finite extent would get a box as big as the whole
+	 * scene and every ray would have to visit them through the hierarchy,
+	 * so they are kept in a list of their own instead.
+	 */
+	std::vector<Object*> bounded;
+	unbounded.clear();
 
 	for(size_t i = 0; i < objects.size(); i++) {
 		objects[i]->calc_bbox();
-		bbroot->add_object(objects[i]);
+
+		if(objects[i]->is_bounded()) {
+			bounded.push_back(objects[i]);
+		} else {
+			unbounded.push_back(objects[i]);
+		}
 	}
+
+	BVHStats stats;
+	bvh = new BVH;
+	bvh->build(bounded.data(), (int)bounded.size(), &stats);
+
+	printf("bounding box tree: %d objects (%d spheres), %d unbounded, %d nodes, %d leaves, depth %d, built in %lu msec\n",
+			(int)bounded.size(), stats.num_spheres, (int)unbounded.size(), stats.num_nodes,
+			stats.num_leaves, stats.max_depth, get_msec() - start);
 }
 
-static Sphere *load_sphere(const char *line) {
+static Sphere *load_sphere(const char *line, const char *end, ParseChunk *chunk, Material *mat) {
 	float x, y, z, dr, dg, db, sr, sg, sb, rad, specexp, kr;
-	Sphere *sph;
 
-	int res = sscanf(line, "s c(%f %f %f) r(%f) kd(%f %f %f) ks(%f %f %f) s(%f) kr(%f)\n",
+	int res = scan_line(line, end, "s c(%f %f %f) r(%f) kd(%f %f %f) ks(%f %f %f) s(%f) kr(%f)",
 			&x, &y, &z, &rad, &dr, &dg, &db, &sr, &sg, &sb, &specexp, &kr);
 	if(res < 12) {
 		return 0;
 	}
 
-	sph = new Sphere(Vector3(x, y, z), rad);
-	Material *mat = sph->get_material();
-
 	mat->kd = Vector3(dr, dg, db);
 	mat->ks = Vector3(sr, sg, sb);
 	mat->specexp = specexp;
 	mat->kr = kr;
-	return sph;
+	return chunk->sphere_mem.create<Sphere>(Vector3(x, y, z), rad);
 }
 
-static Plane *load_plane(const char *line) {
+static Plane *load_plane(const char *line, const char *end, ParseChunk *chunk, Material *mat) {
 	float nx, ny, nz, dr, dg, db, sr, sg, sb, dist, specexp, kr;
-	Plane *plane;
 
-	int res = sscanf(line, "p n(%f %f %f) d(%f) kd(%f %f %f) ks(%f %f %f) s(%f) kr(%f)\n",
+	int res = scan_line(line, end, "p n(%f %f %f) d(%f) kd(%f %f %f) ks(%f %f %f) s(%f) kr(%f)",
 			&nx, &ny, &nz, &dist, &dr, &dg, &db, &sr, &sg, &sb, &specexp, &kr);
 	if(res < 12) {
 		return 0;
 	}
 
-	plane = new Plane(Vector3(nx, ny, nz), dist);
-	Material *mat = plane->get_material();
-
 	mat->kd = Vector3(dr, dg, db);
 	mat->ks = Vector3(sr, sg, sb);
 	mat->specexp = specexp;
 	mat->kr = kr;
-	return plane;
+	return chunk->plane_mem.create<Plane>(Vector3(nx, ny, nz), dist);
 }
 
-static SphereFlake *load_sphflake(const char *line) {
+static SphereFlake *load_sphflake(const char *line, const char *end, ParseChunk *chunk, Material *mat) {
 	float x, y, z, dr, dg, db, sr, sg, sb, rad, specexp, kr;
 	int iter;
 
-	int res = sscanf(line, "f c(%f %f %f) r(%f) i(%d) kd(%f %f %f) ks(%f %f %f) s(%f) kr(%f)\n",
+	int res = scan_line(line, end, "f c(%f %f %f) r(%f) i(%d) kd(%f %f %f) ks(%f %f %f) s(%f) kr(%f)",
 			&x, &y, &z, &rad, &iter, &dr, &dg, &db, &sr, &sg, &sb, &specexp, &kr);
 	if(res < 13) {
 		return 0;
 	}
 
-	SphereFlake *sflake = create_sflake(Vector3(x, y, z), rad, iter);
-	Material *mat = sflake->get_material();
-
 	mat->kd = Vector3(dr, dg, db);
 	mat->ks = Vector3(sr, sg, sb);
 	mat->specexp = specexp;
 	mat->kr = kr;
-	return sflake;
+	return create_sflake(Vector3(x, y, z), rad, iter, &chunk->sflake_mem, &chunk->sphere_mem);
 }
 
-static Camera *load_camera(const char *line) {
+static Camera *load_camera(const char *line, const char *end) {
 	float x, y, z, tx, ty, tz, fov;
 
-	int res = sscanf(line, "c p(%f %f %f) t(%f %f %f) fov(%f)\n", &x, &y, &z, &tx, &ty, &tz, &fov);
+	int res = scan_line(line, end, "c p(%f %f %f) t(%f %f %f) fov(%f)", &x, &y, &z, &tx, &ty, &tz, &fov);
 	if(res < 7) {
 		return 0;
 	}
@@ -255,10 +542,10 @@ static Camera *load_camera(const char *line) {
 	return cam;
 }
 
-static Light *load_light(const char *line) {
+static Light *load_light(const char *line, const char *end) {
 	float x, y, z, r, g, b;
 
-	int res = sscanf(line, "l p(%f %f %f) c(%f %f %f)\n", &x, &y, &z, &r, &g, &b);
+	int res = scan_line(line, end, "l p(%f %f %f) c(%f %f %f)", &x, &y, &z, &r, &g, &b);
 	if(res < 6) {
 		return 0;
 	}
@@ -269,3 +556,186 @@ static Light *load_light(const char *line) {
 
 	return lt;
 }
+
+static inline bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+static inline bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+/* a sscanf for the lines of scene files, which don't end in a 0: knows
+ * %f for floats and %d for ints, blanks match any amount of whitespace and
+ * everything else has to match as it is. Returns the number of values read.
+ */
+static int scan_line(const char *line, const char *end, const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+
+	const char *ptr = line;
+	int count = 0;
+
+	while(*fmt) {
+		if(is_space(*fmt)) {
+			while(ptr < end && is_space(*ptr)) {
+				ptr++;
+			}
+			fmt++;
+			continue;
+		}
+
+		if(*fmt == '%') {
+			while(ptr < end && is_space(*ptr)) {
+				ptr++;
+			}
+
+			bool ok = false;
+			if(fmt[1] == 'f') {
+				ok = parse_float(&ptr, end, va_arg(ap, float*));
+			} else if(fmt[1] == 'd') {
+				ok = parse_int(&ptr, end, va_arg(ap, int*));
+			}
+			if(!ok) {
+				break;
+			}
+			count++;
+			fmt += 2;
+			continue;
+		}
+
+		if(ptr >= end || *ptr != *fmt) {
+			break;
+		}
+		ptr++;
+		fmt++;
+	}
+
+	va_end(ap);
+	return count;
+}
+
+#define MAX_EXACT_MANTISSA	(1ull << 53)
+
+static const double pow10_tab[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* plain decimal numbers with up to 15 or so significant digits, which is all
+ * scene files normally have, are converted with a single exact double
+ * multiplication or division. Going from the double to float then rounds
+ * the same as strtof would, unless the double falls right in the middle of
+ * two floats. That, and anything else like exponents that are too big,
+ * inf or nan, is left to strtof, so the result is always the same as the
+ * old sscanf parser's.
+ */
+static bool parse_float(const char **ptr, const char *end, float *res) {
+	const char *p = *ptr;
+	bool neg = false;
+
+	if(p < end && (*p == '-' || *p == '+')) {
+		neg = *p++ == '-';
+	}
+
+	uint64_t mant = 0;
+	int exp10 = 0;
+	int num_digits = 0;
+	bool exact = true;
+
+	while(p < end && is_digit(*p)) {
+		if(mant < MAX_EXACT_MANTISSA / 10) {
+			mant = mant * 10 + (*p - '0');
+		} else {
+			exp10++;
+			exact = exact && *p == '0';
+		}
+		num_digits++;
+		p++;
+	}
+	if(p < end && *p == '.') {
+		p++;
+		while(p < end && is_digit(*p)) {
+			if(mant < MAX_EXACT_MANTISSA / 10) {
+				mant = mant * 10 + (*p - '0');
+				exp10--;
+			} else {
+				exact = exact && *p == '0';
+			}
+			num_digits++;
+			p++;
+		}
+	}
+
+	if(num_digits && p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool eneg = false;
+		if(q < end && (*q == '-' || *q == '+')) {
+			eneg = *q++ == '-';
+		}
+		if(q < end && is_digit(*q)) {
+			int e = 0;
+			while(q < end && is_digit(*q)) {
+				if(e < 10000) {
+					e = e * 10 + (*q - '0');
+				}
+				q++;
+			}
+			exp10 += eneg ? -e : e;
+			p = q;
+		}
+	}
+
+	// hex floats look like a 0 followed by garbage up to here
+	bool hex = p < end && (*p == 'x' || *p == 'X');
+
+	if(num_digits && exact && !hex && exp10 >= -22 && exp10 <= 22) {
+		double val = exp10 < 0 ? (double)mant / pow10_tab[-exp10] : (double)mant * pow10_tab[exp10];
+
+		uint64_t bits;
+		memcpy(&bits, &val, sizeof bits);
+
+		// exact for floats, unless it's a tie between two of them or not a normal float
+		if(val == 0.0 || (val >= FLT_MIN && val <= FLT_MAX && (bits & 0x1fffffff) != 0x10000000)) {
+			*res = neg ? -(float)val : (float)val;
+			*ptr = p;
+			return true;
+		}
+	}
+
+	// the hard cases, strtof needs them 0 terminated
+	char buf[128];
+	int len = end - *ptr < (int)sizeof buf - 1 ? (int)(end - *ptr) : (int)sizeof buf - 1;
+	memcpy(buf, *ptr, len);
+	buf[len] = 0;
+
+	char *bend;
+	float val = strtof(buf, &bend);
+	if(bend == buf) {
+		return false;
+	}
+	*res = val;
+	*ptr += bend - buf;
+	return true;
+}
+
+static bool parse_int(const char **ptr, const char *end, int *res) {
+	const char *p = *ptr;
+	bool neg = false;
+
+	if(p < end && (*p == '-' || *p == '+')) {
+		neg = *p++ == '-';
+	}
+	if(p >= end || !is_digit(*p)) {
+		return false;
+	}
+
+	int val = 0;
+	while(p < end && is_digit(*p)) {
+		val = val * 10 + (*p++ - '0');
+	}
+
+	*res = neg ? -val : val;
+	*ptr = p;
+	return true;
+}
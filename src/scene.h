@@ -22,19 +22,51 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #ifndef SCENE_H_
 #define SCENE_H_
 
+#include <unordered_map>
 #include <vector>
+#include "arena.h"
 #include "light.h"
 #include "camera.h"
-#include "bbox.h"
+#include "bvh.h"
 #include "intinfo.h"
 #include "object.h"
 
+class MappedFile;
+class CachedObject;
+class Sphere;
+class Plane;
+class SphereFlake;
+
 class Scene {
 private: 
 	std::vector<Object*> objects;
 	Camera *cam;
 	Color ambient;
-	BBoxNode* bbroot;
+	BVH *bvh;
+	std::vector<Object*> unbounded;		// objects kept out of the bvh, see build_bbtree
+
+	/* the objects made by the scene, in an arena per type of primitive, so
+	 * that each type is packed together and they all go at once with the
+	 * scene.
+	 */
+	Arena sphere_mem, plane_mem, sflake_mem;
+
+	// every distinct material once, objects refer to them by index
+	struct MaterialHash {
+		size_t operator()(const Material &mat) const;
+	};
+	struct MaterialEqual {
+		bool operator()(const Material &a, const Material &b) const;
+	};
+	std::vector<Material> materials;
+	std::unordered_map<Material, int, MaterialHash, MaterialEqual> material_index;
+
+	// what the bvh and the objects were loaded from by load_cache, or null
+	MappedFile *cache;
+	CachedObject *cache_objects;
+
+	// name is what parse messages call the scene
+	void load_data(const char *data, size_t size, const char *name);
 
 public:
 	std::vector<Light*> lights;
@@ -45,12 +77,38 @@ public:
 	bool load(const char *fname);
 	bool load(FILE *fp);
 
+	/* the binary scene cache, see scenecache.h. src_fname is the scene file
+	 * it was made from, a cache that doesn't match it any more gets rejected.
+	 * load_cache works on an empty scene, save_cache builds the hierarchy
+	 * if it isn't built yet.
+	 */
+	bool load_cache(const char *fname, const char *src_fname);
+	bool save_cache(const char *fname, const char *src_fname);
+
+	/* make an object in the storage of the scene and add it. material is
+	 * an index from add_material.
+	 */
+	Sphere *add_sphere(const Vector3 &center, scalar_t radius, int material);
+	Plane *add_plane(const Vector3 &normal, scalar_t distance, int material);
+	SphereFlake *add_sphereflake(const Vector3 &center, scalar_t radius, int iter, int material);
+
+	// adds an object that lives elsewhere, the scene doesn't delete it
 	void add_object(Object* object);
+
+	/* index of the material in the material table, adding it if it's not
+	 * there yet. Objects with the same material share the entry.
+	 */
+	int add_material(const Material &mat);
+	const Material *get_material(int idx) const;
+	int get_material_count() const;
+
 	void set_camera(Camera* cam);
 	void set_ambient(const Color &amb);
 	Color get_ambient();
 	Camera* get_camera();
 	bool intersection(const Ray &ray, IntInfo* inter);
+	void intersection(const Ray *rays, int num_rays, IntInfo *inter, bool *hits);
+	bool occluded(const Ray &ray);
 	void build_bbtree();
 };
 
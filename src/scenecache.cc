@@ -0,0 +1,384 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <vector>
+#include "mappedfile.h"
+#include "scenecache.h"
+#include "scene.h"
+#include "plane.h"
+#include "timer.h"
+
+#define BYTE_ORDER_MARK	0x01020304
+
+static bool file_stamp(const char *fname, int64_t *size, int64_t *mtime);
+static const char *check_header(const SceneCacheHeader *hdr, size_t file_size, const char *src_fname);
+static bool check_section(const SceneCacheHeader *hdr, uint64_t offs, int32_t count, size_t elem_size);
+static bool check_nodes(const SceneCacheHeader *hdr, const char *data);
+static uint64_t next_section(uint64_t offs, int32_t count, size_t elem_size);
+static bool write_section(FILE *fp, uint64_t offs, const void *data, size_t size);
+
+bool Scene::save_cache(const char *fname, const char *src_fname) {
+	build_bbtree();
+
+	SceneCacheHeader hdr;
+	memset(&hdr, 0, sizeof hdr);
+
+	memcpy(hdr.magic, SCENE_CACHE_MAGIC, sizeof hdr.magic);
+	hdr.version = SCENE_CACHE_VERSION;
+	hdr.byte_order = BYTE_ORDER_MARK;
+	hdr.node_size = sizeof(BVHNode);
+	hdr.pack_size = sizeof(SpherePack);
+	hdr.material_size = sizeof(Material);
+
+	if (!file_stamp(src_fname, &hdr.src_size, &hdr.src_mtime)) {
+		return false;
+	}
+
+	if (cam) {
+		Vector3 pos = cam->get_position();
+		Vector3 targ = cam->get_target();
+
+		hdr.has_camera = 1;
+		hdr.cam_pos[0] = pos.x;
+		hdr.cam_pos[1] = pos.y;
+		hdr.cam_pos[2] = pos.z;
+		hdr.cam_target[0] = targ.x;
+		hdr.cam_target[1] = targ.y;
+		hdr.cam_target[2] = targ.z;
+		hdr.cam_fov = cam->get_fov();
+	}
+	hdr.ambient[0] = ambient.x;
+	hdr.ambient[1] = ambient.y;
+	hdr.ambient[2] = ambient.z;
+
+	std::vector<CacheLight> cache_lights(lights.size());
+	for (size_t i = 0; i < lights.size(); i++) {
+		CacheLight *lt = &cache_lights[i];
+		lt->position[0] = lights[i]->position.x;
+		lt->position[1] = lights[i]->position.y;
+		lt->position[2] = lights[i]->position.z;
+		lt->color[0] = lights[i]->color.x;
+		lt->color[1] = lights[i]->color.y;
+		lt->color[2] = lights[i]->color.z;
+	}
+
+	// only planes can be left out of the hierarchy
+	std::vector<CachePlane> planes(unbounded.size());
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		const Plane *plane = dynamic_cast<const Plane*>(unbounded[i]);
+		if (!plane) {
+			fprintf(stderr, "scene cache: can't store unbounded objects other than planes\n");
+			return false;
+		}
+
+		CachePlane *cp = &planes[i];
+		memset(cp, 0, sizeof *cp);
+		cp->normal[0] = plane->get_normal().x;
+		cp->normal[1] = plane->get_normal().y;
+		cp->normal[2] = plane->get_normal().z;
+		cp->distance = plane->get_distance();
+		cp->material = plane->get_material();
+	}
+
+	/* and everything in the hierarchy has to be made of spheres, other
+	 * objects would need their own intersection code
+	 */
+	const BVHNode *nodes = bvh->get_nodes();
+	for (int i = 0; i < bvh->get_node_count(); i++) {
+		for (int j = 0; j < BVH_WIDTH; j++) {
+			if (nodes[i].num_objects[j]) {
+				fprintf(stderr, "scene cache: can't store objects that aren't made of spheres\n");
+				return false;
+			}
+		}
+	}
+
+	const Object * const *objects = bvh->get_objects();
+	std::vector<int32_t> obj_material(bvh->get_object_count());
+	for (size_t i = 0; i < obj_material.size(); i++) {
+		obj_material[i] = objects[i]->get_material();
+	}
+
+	hdr.num_lights = (int32_t)cache_lights.size();
+	hdr.num_materials = (int32_t)materials.size();
+	hdr.num_planes = (int32_t)planes.size();
+	hdr.num_objects = (int32_t)obj_material.size();
+	hdr.num_nodes = bvh->get_node_count();
+	hdr.num_packs = bvh->get_pack_count();
+
+	hdr.lights_offs = next_section(0, 1, sizeof hdr);
+	hdr.materials_offs = next_section(hdr.lights_offs, hdr.num_lights, sizeof(CacheLight));
+	hdr.planes_offs = next_section(hdr.materials_offs, hdr.num_materials, sizeof(Material));
+	hdr.objects_offs = next_section(hdr.planes_offs, hdr.num_planes, sizeof(CachePlane));
+	hdr.nodes_offs = next_section(hdr.objects_offs, hdr.num_objects, sizeof(int32_t));
+	hdr.packs_offs = next_section(hdr.nodes_offs, hdr.num_nodes, sizeof(BVHNode));
+	hdr.file_size = hdr.packs_offs + (uint64_t)hdr.num_packs * sizeof(SpherePack);
+
+	FILE *fp;
+	if (!(fp = fopen(fname, "wb"))) {
+		return false;
+	}
+
+	bool res = fwrite(&hdr, sizeof hdr, 1, fp) == 1 &&
+		write_section(fp, hdr.lights_offs, cache_lights.data(), hdr.num_lights * sizeof(CacheLight)) &&
+		write_section(fp, hdr.materials_offs, materials.data(), hdr.num_materials * sizeof(Material)) &&
+		write_section(fp, hdr.planes_offs, planes.data(), hdr.num_planes * sizeof(CachePlane)) &&
+		write_section(fp, hdr.objects_offs, obj_material.data(), hdr.num_objects * sizeof(int32_t)) &&
+		write_section(fp, hdr.nodes_offs, nodes, hdr.num_nodes * sizeof(BVHNode)) &&
+		write_section(fp, hdr.packs_offs, bvh->get_packs(), hdr.num_packs * sizeof(SpherePack));
+
+	if (fclose(fp) == EOF) {
+		res = false;
+	}
+	if (!res) {
+		remove(fname);
+	}
+	return res;
+}
+
+bool Scene::load_cache(const char *fname, const char *src_fname) {
+	unsigned long start = get_msec();
+
+	MappedFile *file = new MappedFile;
+	if (!file->open(fname)) {
+		delete file;
+		return false;
+	}
+
+	const char *data = (const char*)file->get_data();
+	const SceneCacheHeader *hdr = (const SceneCacheHeader*)data;
+
+	const char *err = check_header(hdr, file->get_size(), src_fname);
+	if (!err) {
+		const int32_t *obj_material = (const int32_t*)(data + hdr->objects_offs);
+		const CachePlane *planes = (const CachePlane*)(data + hdr->planes_offs);
+
+		for (int i = 0; i < hdr->num_objects && !err; i++) {
+			if (obj_material[i] < 0 || obj_material[i] >= hdr->num_materials) {
+				err = "is damaged";
+			}
+		}
+		for (int i = 0; i < hdr->num_planes && !err; i++) {
+			if (planes[i].material < 0 || planes[i].material >= hdr->num_materials) {
+				err = "is damaged";
+			}
+		}
+		if (!err && !check_nodes(hdr, data)) {
+			err = "is damaged";
+		}
+	}
+	if (err) {
+		printf("scene cache %s %s, rebuilding it\n", fname, err);
+		delete file;
+		return false;
+	}
+
+	const Material *materials = (const Material*)(data + hdr->materials_offs);
+	CachedObject *proxies = new CachedObject[hdr->num_materials];
+	for (int i = 0; i < hdr->num_materials; i++) {
+		proxies[i].set_material(add_material(materials[i]));
+	}
+
+	const int32_t *obj_material = (const int32_t*)(data + hdr->objects_offs);
+	std::vector<const Object*> table(hdr->num_objects);
+	for (int i = 0; i < hdr->num_objects; i++) {
+		table[i] = proxies + obj_material[i];
+	}
+
+	const CachePlane *planes = (const CachePlane*)(data + hdr->planes_offs);
+	for (int i = 0; i < hdr->num_planes; i++) {
+		const CachePlane *cp = planes + i;
+		Plane *plane = add_plane(Vector3(cp->normal[0], cp->normal[1], cp->normal[2]), cp->distance,
+				proxies[cp->material].get_material());
+		plane->calc_bbox();
+		unbounded.push_back(plane);
+	}
+
+	const CacheLight *cache_lights = (const CacheLight*)(data + hdr->lights_offs);
+	for (int i = 0; i < hdr->num_lights; i++) {
+		const CacheLight *clt = cache_lights + i;
+		Light *lt = new Light;
+		lt->position = Vector3(clt->position[0], clt->position[1], clt->position[2]);
+		lt->color = Vector3(clt->color[0], clt->color[1], clt->color[2]);
+		lights.push_back(lt);
+	}
+
+	if (hdr->has_camera) {
+		Camera *camera = new Camera(Vector3(hdr->cam_pos[0], hdr->cam_pos[1], hdr->cam_pos[2]),
+				Vector3(hdr->cam_target[0], hdr->cam_target[1], hdr->cam_target[2]));
+		camera->set_fov(hdr->cam_fov);
+		set_camera(camera);
+	}
+	ambient = Color(hdr->ambient[0], hdr->ambient[1], hdr->ambient[2]);
+
+	bvh = new BVH;
+	bvh->set_data((const BVHNode*)(data + hdr->nodes_offs), hdr->num_nodes,
+			(const SpherePack*)(data + hdr->packs_offs), hdr->num_packs, table.data(), hdr->num_objects);
+
+	cache = file;
+	cache_objects = proxies;
+
+	printf("scene cache: %s, %d materials, %d nodes, %d sphere packs, loaded in %lu msec\n", fname,
+			hdr->num_materials, hdr->num_nodes, hdr->num_packs, get_msec() - start);
+	return true;
+}
+
+bool CachedObject::intersection(const Ray&, IntInfo*) const {
+	return false;
+}
+
+void CachedObject::calc_bbox() {
+}
+
+/* mtime is in nanoseconds where the system keeps them, so that an edit
+ * within the same second as the one the cache was made from still shows.
+ */
+static bool file_stamp(const char *fname, int64_t *size, int64_t *mtime) {
+	struct stat st;
+	if (stat(fname, &st) == -1) {
+		return false;
+	}
+	*size = (int64_t)st.st_size;
+#if defined(__APPLE__) && defined(__MACH__)
+	*mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined(unix) || defined(__unix__)
+	*mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+	*mtime = (int64_t)st.st_mtime * 1000000000;
+#endif
+	return true;
+}
+
+// returns why the cache can't be used, or null if it can
+static const char *check_header(const SceneCacheHeader *hdr, size_t file_size, const char *src_fname) {
+	if (file_size < sizeof *hdr || memcmp(hdr->magic, SCENE_CACHE_MAGIC, sizeof hdr->magic) != 0) {
+		return "isn't a scene cache";
+	}
+	if (hdr->version != SCENE_CACHE_VERSION) {
+		return "is from another version";
+	}
+	if (hdr->byte_order != BYTE_ORDER_MARK || hdr->node_size != sizeof(BVHNode) ||
+			hdr->pack_size != sizeof(SpherePack) || hdr->material_size != sizeof(Material)) {
+		return "was written on a different kind of machine, or by a build of another precision";
+	}
+
+	int64_t src_size, src_mtime;
+	if (!file_stamp(src_fname, &src_size, &src_mtime) || src_size != hdr->src_size ||
+			src_mtime != hdr->src_mtime) {
+		return "is out of date";
+	}
+
+	if (hdr->file_size != file_size ||
+			!check_section(hdr, hdr->lights_offs, hdr->num_lights, sizeof(CacheLight)) ||
+			!check_section(hdr, hdr->materials_offs, hdr->num_materials, sizeof(Material)) ||
+			!check_section(hdr, hdr->planes_offs, hdr->num_planes, sizeof(CachePlane)) ||
+			!check_section(hdr, hdr->objects_offs, hdr->num_objects, sizeof(int32_t)) ||
+			!check_section(hdr, hdr->nodes_offs, hdr->num_nodes, sizeof(BVHNode)) ||
+			!check_section(hdr, hdr->packs_offs, hdr->num_packs, sizeof(SpherePack))) {
+		return "is damaged";
+	}
+	return 0;
+}
+
+static bool check_section(const SceneCacheHeader *hdr, uint64_t offs, int32_t count, size_t elem_size) {
+	return count >= 0 && offs % SCENE_CACHE_ALIGN == 0 && offs <= hdr->file_size &&
+		(uint64_t)count * elem_size <= hdr->file_size - offs;
+}
+
+/* the nodes and packs are used as they are, so everything they index has
+ * to be in its section. Children always come after their parent, which
+ * also keeps a damaged file from making loops or going deeper than the
+ * traversal stack allows.
+ */
+static bool check_nodes(const SceneCacheHeader *hdr, const char *data) {
+	const BVHNode *nodes = (const BVHNode*)(data + hdr->nodes_offs);
+	const SpherePack *packs = (const SpherePack*)(data + hdr->packs_offs);
+
+	std::vector<int> depth(hdr->num_nodes, 0);
+
+	for (int i = 0; i < hdr->num_nodes; i++) {
+		const BVHNode *node = nodes + i;
+
+		for (int j = 0; j < BVH_WIDTH; j++) {
+			int child = node->child[j];
+
+			if (node->num_packs[j] || node->num_objects[j]) {
+				if (node->num_packs[j] && (child < 0 || child > hdr->num_packs - node->num_packs[j])) {
+					return false;
+				}
+				if (node->num_objects[j] && (node->objects[j] < 0 ||
+						node->objects[j] > hdr->num_objects - node->num_objects[j])) {
+					return false;
+				}
+			} else if (child == -1) {
+				// unused, its bounds must be empty so that it never gets hit
+				for (int k = 0; k < 3; k++) {
+					if (!(node->bounds[0][k][j] > node->bounds[1][k][j])) {
+						return false;
+					}
+				}
+			} else {
+				if (child <= i || child >= hdr->num_nodes || depth[i] + 1 >= BVH_MAX_DEPTH) {
+					return false;
+				}
+				if (depth[child] < depth[i] + 1) {
+					depth[child] = depth[i] + 1;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < hdr->num_packs; i++) {
+		for (int j = 0; j < 4; j++) {
+			int obj = packs[i].object[j];
+
+			// lanes without an object must not be hittable either
+			if (obj < -1 || obj >= hdr->num_objects || (obj == -1 && !(packs[i].rsq[j] < 0.0))) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// offset of the section after the one at offs
+static uint64_t next_section(uint64_t offs, int32_t count, size_t elem_size) {
+	offs += (uint64_t)count * elem_size;
+	return (offs + SCENE_CACHE_ALIGN - 1) & ~(uint64_t)(SCENE_CACHE_ALIGN - 1);
+}
+
+// pads the file up to offs and writes the section there
+static bool write_section(FILE *fp, uint64_t offs, const void *data, size_t size) {
+	static const char zeros[SCENE_CACHE_ALIGN] = {0};
+
+	long pos = ftell(fp);
+	if (pos < 0 || (uint64_t)pos > offs || offs - pos > sizeof zeros) {
+		return false;
+	}
+	if (fwrite(zeros, 1, offs - pos, fp) != offs - pos) {
+		return false;
+	}
+	return !size || fwrite(data, 1, size, fp) == size;
+}
@@ -0,0 +1,98 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef SCENECACHE_H_
+#define SCENECACHE_H_
+
+/* binary scene cache. Holds what Scene::load and build_bbtree come up with:
+ * the camera, the lights, a table of the distinct materials, the planes and
+ * the built hierarchy, so that rendering a big scene again doesn't have to
+ * parse and build it all over. The file gets mapped to memory and the nodes
+ * and sphere packs are used right from there.
+ *
+ * The header is followed by the sections at the offsets it gives, each one
+ * aligned to a cache line. Everything is in the byte order and struct layout
+ * of the machine that wrote it, a cache written anywhere else is rejected
+ * and rebuilt, same as one older than its scene file.
+ */
+
+#include <stdint.h>
+#include "object.h"
+
+#define SCENE_CACHE_MAGIC	"RTSCACHE"
+#define SCENE_CACHE_VERSION	2
+#define SCENE_CACHE_ALIGN	64
+
+struct SceneCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;	// 0x01020304 as written
+	uint32_t node_size, pack_size, material_size;
+	uint32_t pad;
+
+	// the scene file the cache was made from
+	int64_t src_size;
+	int64_t src_mtime;	// nanoseconds
+
+	int32_t has_camera;
+	int32_t pad2;
+	double cam_pos[3], cam_target[3], cam_fov;
+	double ambient[3];
+
+	int32_t num_lights;
+	int32_t num_materials;
+	int32_t num_planes;
+	int32_t num_objects;	// entries of the object table of the bvh
+	int32_t num_nodes;
+	int32_t num_packs;
+
+	uint64_t lights_offs;
+	uint64_t materials_offs;	// Material
+	uint64_t planes_offs;
+	uint64_t objects_offs;		// int32_t material of each object table entry
+	uint64_t nodes_offs;		// BVHNode
+	uint64_t packs_offs;		// SpherePack
+	uint64_t file_size;
+};
+
+struct CacheLight {
+	double position[3];
+	double color[3];
+};
+
+struct CachePlane {
+	double normal[3];
+	double distance;
+	int32_t material;
+	int32_t pad;
+};
+
+/* stands in for the objects of a cached scene when they get hit. Their
+ * spheres are in the hierarchy already, so all that's left for one to do
+ * is carry the material, and the objects with the same material share one.
+ */
+class CachedObject : public Object {
+public:
+	bool intersection(const Ray &ray, IntInfo *i_info) const;
+	void calc_bbox();
+};
+
+#endif
@@ -0,0 +1,172 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "shade.h"
+#include "light.h"
+#include "object.h"
+#include "stats.h"
+#include "vector.h"
+
+double path_cutoff = PATH_CUTOFF;
+bool path_roulette = false;
+
+static double path_random(const Vector3 &p, int depth);
+
+Color trace(const Ray &ray, int depth) {
+	IntInfo min_info;
+	bool isect = scene.intersection(ray, &min_info);
+	if (isect) {
+		return shade(ray, &min_info, depth);
+	}
+
+	return Color(0, 0, 0);
+}
+
+/* follows the reflections of the ray in a loop rather than recursing,
+ * keeping the weight each bounce has on the final color, see next_bounce.
+ */
+Color shade(const Ray &ray, IntInfo* min_info, int depth) {
+	Color color = Color(0, 0, 0);
+	Color weight = Color(1, 1, 1);
+
+	const Ray *cur = &ray;
+	const IntInfo *hit = min_info;
+	Ray refray;
+	IntInfo refhit;
+
+	for (; depth > 0; depth--) {
+		STAT_DEPTH(MAX_DEPTH - depth);
+
+		Vector3 n = hit->normal;
+		Vector3 p = hit->i_point;
+		Vector3 v = normalize(cur->origin - p);
+		const Material *mat = scene.get_material(hit->object->get_material());
+
+		Color local = scene.get_ambient() * mat->kd;
+
+		for (int i = 0; i < (int)scene.lights.size(); i++) {
+			const Light *light = scene.lights[i];
+
+			Vector3 sorg = secondary_origin(p, n, light->position - p);
+			Ray sray(sorg, light->position - sorg, 0);
+			STAT_INC(STAT_SHADOW_RAYS);
+
+			if (!scene.occluded(sray)) {
+				local = local + light_color(sray.dir, n, v, mat, light);
+			}
+		}
+
+		color = color + weight * local;
+
+		if (!next_bounce(&weight, mat, p, depth)) {
+			break;
+		}
+
+		Vector3 rdir = reflect(-cur->dir, n);
+		refray = Ray(secondary_origin(p, n, rdir), rdir, 0);
+		STAT_INC(STAT_REFLECTION_RAYS);
+
+		if (!scene.intersection(refray, &refhit)) {
+			break;
+		}
+		cur = &refray;
+		hit = &refhit;
+	}
+
+	return color;
+}
+
+Color light_color(const Vector3 &ldir, const Vector3 &n, const Vector3 &v, const Material *mat,
+		const Light *light) {
+	Vector3 l = normalize(ldir);
+	Vector3 lr = reflect(l, n); 
+
+	double d = dot(n, l);
+	if (d < 0.0) {
+		d = 0;
+	}
+
+	double lrdotv = dot(lr, v);
+	if(lrdotv < 0.0) {
+		lrdotv = 0.0;
+	}
+
+	double s = pow(lrdotv, mat->specexp);
+	return (d * mat->kd + s * mat->ks) * light->color;
+}
+
+/* once the weight of a path drops below path_cutoff the rest of it can't
+ * make a visible difference and is left out, or with path_roulette, it goes
+ * on with a chance proportional to its weight and gets weighted up by as much.
+ */
+bool next_bounce(Color *weight, const Material *mat, const Vector3 &p, int depth) {
+	// the last bounce would be shaded black anyway
+	if (mat->kr <= 0.0 || depth <= 1) {
+		return false;
+	}
+
+	*weight = *weight * mat->kr * mat->ks;
+
+	double max_weight = weight->x > weight->y ? weight->x : weight->y;
+	if (weight->z > max_weight) {
+		max_weight = weight->z;
+	}
+
+	if (max_weight < path_cutoff) {
+		if (!path_roulette) {
+			return false;
+		}
+
+		double survive = max_weight / path_cutoff;
+		if (path_random(p, depth) >= survive) {
+			return false;
+		}
+		*weight = *weight / survive;
+	}
+	return true;
+}
+
+/* a number in [0, 1) that only depends on where a path is and how far along
+ * it is, so that the roulette comes out the same however the image is split
+ * between threads.
+ */
+static double path_random(const Vector3 &p, int depth) {
+	// as doubles, so that it hashes all 64 bits with floats too
+	double coord[3] = {p.x, p.y, p.z};
+	uint64_t bits[3];
+	memcpy(bits, coord, sizeof bits);
+
+	uint64_t h = (uint64_t)depth * 0x9e3779b97f4a7c15ull;
+	for (int i = 0; i < 3; i++) {
+		// splitmix64 finalizer
+		h ^= bits[i];
+		h ^= h >> 30;
+		h *= 0xbf58476d1ce4e5b9ull;
+		h ^= h >> 27;
+		h *= 0x94d049bb133111ebull;
+		h ^= h >> 31;
+	}
+	return (h >> 11) * (1.0 / 9007199254740992.0);
+}
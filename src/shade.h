@@ -0,0 +1,56 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef SHADE_H_
+#define SHADE_H_
+
+#include "color.h"
+#include "intinfo.h"
+#include "light.h"
+#include "object.h"
+#include "ray.h"
+#include "scene.h"
+
+// the scene everything gets traced against
+extern Scene scene;
+
+/* reflections weighing less than this on the color of a pixel are left
+ * out, 0 follows them all the way to MAX_DEPTH. With path_roulette they go
+ * on at random instead, see shade.
+ */
+extern double path_cutoff;
+extern bool path_roulette;
+
+Color trace(const Ray &ray, int depth);
+Color shade(const Ray &ray, IntInfo *min_info, int depth);
+
+/* the parts of shade, for renderers that schedule the rays on their own. */
+
+// diffuse and specular light from the light in direction ldir, if nothing's in the way
+Color light_color(const Vector3 &ldir, const Vector3 &n, const Vector3 &v, const Material *mat,
+		const Light *light);
+
+/* updates the weight of a path for its reflection off mat at p, depth
+ * levels before MAX_DEPTH runs out. Returns false if it's not worth tracing.
+ */
+bool next_bounce(Color *weight, const Material *mat, const Vector3 &p, int depth);
+
+#endif
@@ -0,0 +1,182 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include "config.h"
+
+/* 4 wide vectors of scalar_t. Doubles are mapped to AVX or SSE2 depending
+ * on what the compiler is allowed to use, floats fit in a single SSE
+ * register. There's a plain C fallback for either.
+ */
+#if defined(RT_FLOAT) && (defined(__SSE__) || defined(_M_X64))
+#include <xmmintrin.h>
+#define SIMD_SSE
+#elif defined(RT_FLOAT)
+#include <math.h>
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SIMD_SSE2
+#else
+#include <math.h>
+#endif
+
+struct Pack4 {
+#if defined(SIMD_SSE)
+	__m128 v;
+#elif defined(SIMD_AVX)
+	__m256d v;
+#elif defined(SIMD_SSE2)
+	__m128d lo, hi;
+#else
+	scalar_t v[4];
+#endif
+};
+
+#if defined(SIMD_SSE)
+
+inline Pack4 p4_load(const float *p) { Pack4 r; r.v = _mm_load_ps(p); return r; }
+inline Pack4 p4_set1(float x) { Pack4 r; r.v = _mm_set1_ps(x); return r; }
+inline void p4_store(float *p, const Pack4 &a) { _mm_store_ps(p, a.v); }
+
+inline Pack4 operator + (const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm_add_ps(a.v, b.v); return r; }
+inline Pack4 operator - (const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm_sub_ps(a.v, b.v); return r; }
+inline Pack4 operator * (const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm_mul_ps(a.v, b.v); return r; }
+
+// like the instructions for doubles, if either argument is NaN the second one is returned
+inline Pack4 p4_min(const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm_min_ps(a.v, b.v); return r; }
+inline Pack4 p4_max(const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm_max_ps(a.v, b.v); return r; }
+
+inline Pack4 p4_sqrt(const Pack4 &a) { Pack4 r; r.v = _mm_sqrt_ps(a.v); return r; }
+
+inline int p4_le(const Pack4 &a, const Pack4 &b) { return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v)); }
+
+inline Pack4 p4_cmple(const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm_cmple_ps(a.v, b.v); return r; }
+inline Pack4 p4_and(const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm_and_ps(a.v, b.v); return r; }
+inline int p4_mask(const Pack4 &m) { return _mm_movemask_ps(m.v); }
+
+inline Pack4 p4_select(const Pack4 &m, const Pack4 &a, const Pack4 &b) {
+	Pack4 r;
+	r.v = _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v));
+	return r;
+}
+
+#elif defined(SIMD_AVX)
+
+inline Pack4 p4_load(const double *p) { Pack4 r; r.v = _mm256_load_pd(p); return r; }
+inline Pack4 p4_set1(double x) { Pack4 r; r.v = _mm256_set1_pd(x); return r; }
+inline void p4_store(double *p, const Pack4 &a) { _mm256_store_pd(p, a.v); }
+
+inline Pack4 operator + (const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm256_add_pd(a.v, b.v); return r; }
+inline Pack4 operator - (const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm256_sub_pd(a.v, b.v); return r; }
+inline Pack4 operator * (const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm256_mul_pd(a.v, b.v); return r; }
+
+// like the SSE instructions, if either argument is NaN the second one is returned
+inline Pack4 p4_min(const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm256_min_pd(a.v, b.v); return r; }
+inline Pack4 p4_max(const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm256_max_pd(a.v, b.v); return r; }
+
+inline Pack4 p4_sqrt(const Pack4 &a) { Pack4 r; r.v = _mm256_sqrt_pd(a.v); return r; }
+
+// bit i of the result is set if a[i] <= b[i]
+inline int p4_le(const Pack4 &a, const Pack4 &b) { return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ)); }
+
+// lane masks, all bits set where a[i] <= b[i]
+inline Pack4 p4_cmple(const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ); return r; }
+inline Pack4 p4_and(const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm256_and_pd(a.v, b.v); return r; }
+inline int p4_mask(const Pack4 &m) { return _mm256_movemask_pd(m.v); }
+
+// a where the mask is set, b elsewhere
+inline Pack4 p4_select(const Pack4 &m, const Pack4 &a, const Pack4 &b) { Pack4 r; r.v = _mm256_blendv_pd(b.v, a.v, m.v); return r; }
+
+#elif defined(SIMD_SSE2)
+
+inline Pack4 p4_load(const double *p) { Pack4 r; r.lo = _mm_load_pd(p); r.hi = _mm_load_pd(p + 2); return r; }
+inline Pack4 p4_set1(double x) { Pack4 r; r.lo = r.hi = _mm_set1_pd(x); return r; }
+inline void p4_store(double *p, const Pack4 &a) { _mm_store_pd(p, a.lo); _mm_store_pd(p + 2, a.hi); }
+
+inline Pack4 operator + (const Pack4 &a, const Pack4 &b) { Pack4 r; r.lo = _mm_add_pd(a.lo, b.lo); r.hi = _mm_add_pd(a.hi, b.hi); return r; }
+inline Pack4 operator - (const Pack4 &a, const Pack4 &b) { Pack4 r; r.lo = _mm_sub_pd(a.lo, b.lo); r.hi = _mm_sub_pd(a.hi, b.hi); return r; }
+inline Pack4 operator * (const Pack4 &a, const Pack4 &b) { Pack4 r; r.lo = _mm_mul_pd(a.lo, b.lo); r.hi = _mm_mul_pd(a.hi, b.hi); return r; }
+
+inline Pack4 p4_min(const Pack4 &a, const Pack4 &b) { Pack4 r; r.lo = _mm_min_pd(a.lo, b.lo); r.hi = _mm_min_pd(a.hi, b.hi); return r; }
+inline Pack4 p4_max(const Pack4 &a, const Pack4 &b) { Pack4 r; r.lo = _mm_max_pd(a.lo, b.lo); r.hi = _mm_max_pd(a.hi, b.hi); return r; }
+
+inline Pack4 p4_sqrt(const Pack4 &a) { Pack4 r; r.lo = _mm_sqrt_pd(a.lo); r.hi = _mm_sqrt_pd(a.hi); return r; }
+
+inline int p4_le(const Pack4 &a, const Pack4 &b) {
+	return _mm_movemask_pd(_mm_cmple_pd(a.lo, b.lo)) | (_mm_movemask_pd(_mm_cmple_pd(a.hi, b.hi)) << 2);
+}
+
+inline Pack4 p4_cmple(const Pack4 &a, const Pack4 &b) { Pack4 r; r.lo = _mm_cmple_pd(a.lo, b.lo); r.hi = _mm_cmple_pd(a.hi, b.hi); return r; }
+inline Pack4 p4_and(const Pack4 &a, const Pack4 &b) { Pack4 r; r.lo = _mm_and_pd(a.lo, b.lo); r.hi = _mm_and_pd(a.hi, b.hi); return r; }
+inline int p4_mask(const Pack4 &m) { return _mm_movemask_pd(m.lo) | (_mm_movemask_pd(m.hi) << 2); }
+
+inline Pack4 p4_select(const Pack4 &m, const Pack4 &a, const Pack4 &b) {
+	Pack4 r;
+	r.lo = _mm_or_pd(_mm_and_pd(m.lo, a.lo), _mm_andnot_pd(m.lo, b.lo));
+	r.hi = _mm_or_pd(_mm_and_pd(m.hi, a.hi), _mm_andnot_pd(m.hi, b.hi));
+	return r;
+}
+
+#else
+
+inline Pack4 p4_load(const scalar_t *p) { Pack4 r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+inline Pack4 p4_set1(scalar_t x) { Pack4 r; for (int i = 0; i < 4; i++) r.v[i] = x; return r; }
+inline void p4_store(scalar_t *p, const Pack4 &a) { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+
+inline Pack4 operator + (const Pack4 &a, const Pack4 &b) { Pack4 r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] + b.v[i]; return r; }
+inline Pack4 operator - (const Pack4 &a, const Pack4 &b) { Pack4 r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] - b.v[i]; return r; }
+inline Pack4 operator * (const Pack4 &a, const Pack4 &b) { Pack4 r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] * b.v[i]; return r; }
+
+inline Pack4 p4_min(const Pack4 &a, const Pack4 &b) { Pack4 r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r; }
+inline Pack4 p4_max(const Pack4 &a, const Pack4 &b) { Pack4 r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r; }
+
+inline Pack4 p4_sqrt(const Pack4 &a) { Pack4 r; for (int i = 0; i < 4; i++) r.v[i] = sqrt(a.v[i]); return r; }
+
+inline int p4_le(const Pack4 &a, const Pack4 &b) {
+	int mask = 0;
+	for (int i = 0; i < 4; i++) {
+		if (a.v[i] <= b.v[i]) mask |= 1 << i;
+	}
+	return mask;
+}
+
+// the lanes of the masks are 1.0 where set and 0.0 elsewhere
+inline Pack4 p4_cmple(const Pack4 &a, const Pack4 &b) { Pack4 r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] <= b.v[i] ? 1.0 : 0.0; return r; }
+inline Pack4 p4_and(const Pack4 &a, const Pack4 &b) { Pack4 r; for (int i = 0; i < 4; i++) r.v[i] = a.v[i] * b.v[i]; return r; }
+
+inline int p4_mask(const Pack4 &m) {
+	int mask = 0;
+	for (int i = 0; i < 4; i++) {
+		if (m.v[i] != 0.0) mask |= 1 << i;
+	}
+	return mask;
+}
+
+inline Pack4 p4_select(const Pack4 &m, const Pack4 &a, const Pack4 &b) { Pack4 r; for (int i = 0; i < 4; i++) r.v[i] = m.v[i] != 0.0 ? a.v[i] : b.v[i]; return r; }
+
+#endif
+
+#endif
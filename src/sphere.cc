@@ -22,18 +22,22 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #include "math.h"
 #include "sphere.h"
 #include "config.h"
+#include "bvh.h"
+#include "stats.h"
 
 Sphere::Sphere() {
 	center = Vector3(0,0,0);
 	radius = 1;
 }
 
-Sphere::Sphere(const Vector3 &center, double radius) {
+Sphere::Sphere(const Vector3 &center, scalar_t radius) {
 	this->center = center;
 	this->radius = radius;
 }
 
 bool Sphere::intersection(const Ray &ray, IntInfo* i_info) const {
+	STAT_INC(STAT_SPHERE_TESTS);
+
 	// first check if the ray intersects the bounding box of the sphere
 	// this is marginally faster (measured)
 #ifdef USE_BBOX
@@ -42,36 +46,41 @@ bool Sphere::intersection(const Ray &ray, IntInfo* i_info) const {
 	}
 #endif
 
-	double a = dot(ray.dir, ray.dir);
-	double b = 2 * ray.dir.x * (ray.origin.x - center.x) +
-		2 * ray.dir.y * (ray.origin.y - center.y) +
-		2 * ray.dir.z * (ray.origin.z - center.z);
-	double c = dot(center, center) + dot(ray.origin, ray.origin) + 
-		2 * dot(-center, ray.origin) - radius * radius;
-	
-	double discr = (b * b - 4 * a * c);
+	Vector3 oc = ray.origin - center;
+
+	scalar_t a = dot(ray.dir, ray.dir);
+	scalar_t b = 2 * dot(ray.dir, oc);
+
+	/* b^2 - 4ac, without the cancellation between its terms that leaves
+	 * floats with nothing, see pack_intersection in bvh.cc.
+	 */
+	Vector3 f = oc - ray.dir * (b / (2 * a));
+	scalar_t discr = 4 * a * (radius * radius - dot(f, f));
 
 	if (discr < 0.0) {
 		return false;
 	}
 
-	double sqrt_discr = sqrt(discr);
-	double t1 = (-b + sqrt_discr) / (2.0 * a);
-	double t2 = (-b - sqrt_discr) / (2.0 * a);
+	scalar_t sqrt_discr = sqrt(discr);
+	scalar_t t1 = (-b + sqrt_discr) / (2 * a);
+	scalar_t t2 = (-b - sqrt_discr) / (2 * a);
 
-	if (t1 < EPSILON) t1 = t2;
-	if (t2 < EPSILON) t2 = t1;
+	if (t1 < ray.tmin) t1 = t2;
+	if (t2 < ray.tmin) t2 = t1;
 
-	double t = t1 < t2 ? t1 : t2;
+	scalar_t t = t1 < t2 ? t1 : t2;
 
-	if (t < EPSILON || t > 1.0) {
+	if (t < ray.tmin || t > ray.tmax) {
 		return false;
 	}
 
+	STAT_INC(STAT_SPHERE_HITS);
 	if (i_info) {
 		i_info->t = t;
-		i_info->i_point = ray.origin + ray.dir * t;
-		i_info->normal = (i_info->i_point - center) / radius;
+		// back on the surface, see finish_ray in bvh.cc
+		Vector3 p = ray.origin + ray.dir * t;
+		i_info->normal = normalize(p - center);
+		i_info->i_point = center + i_info->normal * radius;
 		i_info->object = this;
 	}
 	return true;
@@ -81,3 +90,11 @@ void Sphere::calc_bbox() {
 	bbox.max = center + Vector3(radius, radius, radius);
 	bbox.min = center - Vector3(radius, radius, radius);
 }
+
+bool Sphere::get_spheres(std::vector<BVHSphere> *spheres) const {
+	BVHSphere sph;
+	sph.center = center;
+	sph.radius = radius;
+	spheres->push_back(sph);
+	return true;
+}
@@ -28,12 +28,13 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 class Sphere: public Object {
 private:
 	Vector3 center;
-	double radius;
+	scalar_t radius;
 public:
 	Sphere();
-	Sphere(const Vector3 &center, double radius);
+	Sphere(const Vector3 &center, scalar_t radius);
 	bool intersection(const Ray &ray, IntInfo* i_info) const;
 	void calc_bbox();
+	bool get_spheres(std::vector<BVHSphere> *spheres) const;
 };
 
 #endif
@@ -23,22 +23,19 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #include <string.h>
 #include "sphereflake.h"
 #include "config.h"
+#include "bvh.h"
+#include "stats.h"
 
-SphereFlake::SphereFlake(const Vector3 &center, double radius) {
+SphereFlake::SphereFlake(const Vector3 &center, scalar_t radius) {
 	this->center = center;
 	this->radius = radius;
 	sph = 0;
 	memset(subflakes, 0, sizeof subflakes);
 }
 
-SphereFlake::~SphereFlake() {
-	for (size_t i = 0; i < 6; i++) {
-		delete subflakes[i];
-	}
-	delete sph;
-}
-
 bool SphereFlake::intersection(const Ray &ray, IntInfo* i_info) const {
+	STAT_INC(STAT_SFLAKE_TESTS);
+
 #ifdef USE_BBOX
 	if (!bbox.intersection(ray)) {
 		return false;
@@ -65,6 +62,7 @@ bool SphereFlake::intersection(const Ray &ray, IntInfo* i_info) const {
 	}
 
 	if (minsect.object) {
+		STAT_INC(STAT_SFLAKE_HITS);
 		if (i_info) {
 			*i_info = minsect;
 			i_info->object = this;
@@ -75,13 +73,31 @@ bool SphereFlake::intersection(const Ray &ray, IntInfo* i_info) const {
 }
 
 void SphereFlake::calc_bbox() {
-	double max_rad = 3.0 * radius;
+	scalar_t max_rad = 3.0 * radius;
 
 	bbox.max = center + Vector3(max_rad, max_rad, max_rad);
 	bbox.min = center - Vector3(max_rad, max_rad, max_rad);
 }
 
 
+bool SphereFlake::get_spheres(std::vector<BVHSphere> *spheres) const {
+	add_spheres(spheres);
+	return true;
+}
+
+// all the spheres of the flake get reported as hits on the flake itself
+void SphereFlake::add_spheres(std::vector<BVHSphere> *spheres) const {
+	BVHSphere s;
+	s.center = center;
+	s.radius = radius;
+	spheres->push_back(s);
+
+	for (int i = 0; i < 6; i++) {
+		if (subflakes[i]) {
+			subflakes[i]->add_spheres(spheres);
+		}
+	}
+}
 
 static const Vector3 offs[] = {
 	Vector3(1, 0, 0), Vector3(-1, 0, 0),
@@ -89,20 +105,21 @@ static const Vector3 offs[] = {
 	Vector3(0, 0, 1), Vector3(0, 0, -1)
 };
 
-SphereFlake *create_sflake(const Vector3 &center, double radius, int iter) {
+SphereFlake *create_sflake(const Vector3 &center, scalar_t radius, int iter, Arena *flakes,
+		Arena *spheres) {
 	if (!iter) return 0;
 
-	SphereFlake *sflake = new SphereFlake(center, radius);
+	SphereFlake *sflake = flakes->create<SphereFlake>(center, radius);
 	sflake->calc_bbox();
 
-	sflake->sph = new Sphere(center, radius);
+	sflake->sph = spheres->create<Sphere>(center, radius);
 	sflake->sph->calc_bbox();
 
 	for (int i = 0; i < 6; i++) {
-		double d = radius + radius / 2.0;
+		scalar_t d = radius + radius / 2.0;
 		Vector3 sub_pos = center + offs[i] * d;
 
-		sflake->subflakes[i] = create_sflake(sub_pos, radius / 2.0, iter - 1);
+		sflake->subflakes[i] = create_sflake(sub_pos, radius / 2.0, iter - 1, flakes, spheres);
 	}
 	return sflake;
 }
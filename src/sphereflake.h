@@ -23,6 +23,7 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #define SPHEREFLAKE_H_
 
 #include <vector>
+#include "arena.h"
 #include "object.h"
 #include "sphere.h"
 
@@ -32,19 +33,26 @@ private:
 	SphereFlake *subflakes[6];
 
 	Vector3 center;
-	double radius;
+	scalar_t radius;
+
+	void add_spheres(std::vector<BVHSphere> *spheres) const;
 
 public:
-	SphereFlake(const Vector3 &center, double radius);
-	~SphereFlake();
+	SphereFlake(const Vector3 &center, scalar_t radius);
 
 	bool intersection(const Ray &ray, IntInfo* i_info) const;
 
 	void calc_bbox();
+	bool get_spheres(std::vector<BVHSphere> *spheres) const;
 
-	friend SphereFlake *create_sflake(const Vector3 &center, double radius, int iter);
+	friend SphereFlake *create_sflake(const Vector3 &center, scalar_t radius, int iter,
+			Arena *flakes, Arena *spheres);
 };
 
-SphereFlake *create_sflake(const Vector3 &center, double radius, int iter);
+/* makes a flake of iter levels, with the flakes and the spheres they are
+ * made of in the given arenas, which own them from then on.
+ */
+SphereFlake *create_sflake(const Vector3 &center, scalar_t radius, int iter, Arena *flakes,
+		Arena *spheres);
 
 #endif
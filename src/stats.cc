@@ -0,0 +1,144 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifdef RT_STATS
+
+#include <mutex>
+#include <string.h>
+#include "stats.h"
+
+static const char *stat_names[NUM_STATS] = {
+	"primary_rays",
+	"shadow_rays",
+	"reflection_rays",
+	"node_visits",
+	"bbox_tests",
+	"pack_tests",
+	"pack_hits",
+	"sphere_tests",
+	"sphere_hits",
+	"plane_tests",
+	"plane_hits",
+	"sflake_tests",
+	"sflake_hits"
+};
+
+// counters of the threads that are gone
+static RenderStats totals;
+static std::mutex totals_lock;
+
+thread_local ThreadStats thread_stats;
+
+static void add_stats(RenderStats *dest, const RenderStats *src);
+
+ThreadStats::ThreadStats() {
+	memset(count, 0, sizeof count);
+	memset(depth, 0, sizeof depth);
+}
+
+ThreadStats::~ThreadStats() {
+	std::lock_guard<std::mutex> guard(totals_lock);
+	add_stats(&totals, this);
+}
+
+void stats_collect(RenderStats *stats) {
+	std::lock_guard<std::mutex> guard(totals_lock);
+
+	*stats = totals;
+	add_stats(stats, &thread_stats);
+
+	memset(&totals, 0, sizeof totals);
+	memset(thread_stats.count, 0, sizeof thread_stats.count);
+	memset(thread_stats.depth, 0, sizeof thread_stats.depth);
+}
+
+void stats_print(FILE *fp, const RenderStats *stats) {
+	const uint64_t *c = stats->count;
+	uint64_t num_rays = c[STAT_PRIMARY_RAYS] + c[STAT_SHADOW_RAYS] + c[STAT_REFLECTION_RAYS];
+
+	fprintf(fp, "render statistics:\n");
+	fprintf(fp, "  rays: %llu (%llu primary, %llu shadow, %llu reflection)\n",
+			(unsigned long long)num_rays, (unsigned long long)c[STAT_PRIMARY_RAYS],
+			(unsigned long long)c[STAT_SHADOW_RAYS], (unsigned long long)c[STAT_REFLECTION_RAYS]);
+	fprintf(fp, "  bvh node visits: %llu (%.2f per ray)\n", (unsigned long long)c[STAT_NODE_VISITS],
+			num_rays ? (double)c[STAT_NODE_VISITS] / num_rays : 0.0);
+	fprintf(fp, "  bbox tests: %llu\n", (unsigned long long)c[STAT_BBOX_TESTS]);
+
+	static const struct { const char *name; int tests, hits; } prims[] = {
+		{"sphere packs", STAT_PACK_TESTS, STAT_PACK_HITS},
+		{"spheres", STAT_SPHERE_TESTS, STAT_SPHERE_HITS},
+		{"planes", STAT_PLANE_TESTS, STAT_PLANE_HITS},
+		{"sphereflakes", STAT_SFLAKE_TESTS, STAT_SFLAKE_HITS}
+	};
+	for (size_t i = 0; i < sizeof prims / sizeof *prims; i++) {
+		uint64_t tests = c[prims[i].tests];
+		uint64_t hits = c[prims[i].hits];
+
+		fprintf(fp, "  %s: %llu tests, %llu hits (%.1f%%)\n", prims[i].name, (unsigned long long)tests,
+				(unsigned long long)hits, tests ? 100.0 * hits / tests : 0.0);
+	}
+
+	int max_depth = -1;
+	for (int i = 0; i < MAX_DEPTH; i++) {
+		if (stats->depth[i]) {
+			max_depth = i;
+		}
+	}
+	fprintf(fp, "  deepest recursion: %d, shade calls per level:", max_depth);
+	for (int i = 0; i <= max_depth; i++) {
+		fprintf(fp, " %llu", (unsigned long long)stats->depth[i]);
+	}
+	fputc('\n', fp);
+}
+
+bool stats_write_json(const char *fname, const RenderStats *stats) {
+	FILE *fp;
+	if (!(fp = fopen(fname, "w"))) {
+		return false;
+	}
+
+	fprintf(fp, "{\n");
+	for (int i = 0; i < NUM_STATS; i++) {
+		fprintf(fp, "\t\"%s\": %llu,\n", stat_names[i], (unsigned long long)stats->count[i]);
+	}
+	fprintf(fp, "\t\"shade_calls_per_depth\": [");
+	for (int i = 0; i < MAX_DEPTH; i++) {
+		fprintf(fp, "%s%llu", i ? ", " : "", (unsigned long long)stats->depth[i]);
+	}
+	fprintf(fp, "]\n}\n");
+
+	bool res = !ferror(fp);
+	if (fclose(fp) == EOF) {
+		res = false;
+	}
+	return res;
+}
+
+static void add_stats(RenderStats *dest, const RenderStats *src) {
+	for (int i = 0; i < NUM_STATS; i++) {
+		dest->count[i] += src->count[i];
+	}
+	for (int i = 0; i < MAX_DEPTH; i++) {
+		dest->depth[i] += src->depth[i];
+	}
+}
+
+#endif	// RT_STATS
@@ -0,0 +1,86 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef STATS_H_
+#define STATS_H_
+
+/* render statistics. The counters only exist when building with -DRT_STATS,
+ * otherwise the STAT_ macros expand to nothing and cost nothing.
+ *
+ * Every thread counts into its own copy, which gets added to the totals when
+ * the thread exits, or by stats_collect for the calling thread.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "config.h"
+
+enum {
+	STAT_PRIMARY_RAYS,
+	STAT_SHADOW_RAYS,
+	STAT_REFLECTION_RAYS,
+	STAT_NODE_VISITS,		// 4-wide bvh nodes
+	STAT_BBOX_TESTS,		// BBox::intersection calls
+	STAT_PACK_TESTS,		// 4-wide sphere packs in the bvh leaves
+	STAT_PACK_HITS,
+	STAT_SPHERE_TESTS,
+	STAT_SPHERE_HITS,
+	STAT_PLANE_TESTS,
+	STAT_PLANE_HITS,
+	STAT_SFLAKE_TESTS,
+	STAT_SFLAKE_HITS,
+
+	NUM_STATS
+};
+
+struct RenderStats {
+	uint64_t count[NUM_STATS];
+	uint64_t depth[MAX_DEPTH];	// shade calls per recursion level
+};
+
+#ifdef RT_STATS
+
+struct ThreadStats : RenderStats {
+	ThreadStats();
+	~ThreadStats();
+};
+
+extern thread_local ThreadStats thread_stats;
+
+#define STAT_INC(s)		(thread_stats.count[s]++)
+#define STAT_ADD(s, n)	(thread_stats.count[s] += (n))
+#define STAT_DEPTH(d)	(thread_stats.depth[d]++)
+
+// adds up the counters of all threads, including the calling one, and clears them
+void stats_collect(RenderStats *stats);
+
+void stats_print(FILE *fp, const RenderStats *stats);
+bool stats_write_json(const char *fname, const RenderStats *stats);
+
+#else
+
+#define STAT_INC(s)
+#define STAT_ADD(s, n)
+#define STAT_DEPTH(d)
+
+#endif	// RT_STATS
+
+#endif
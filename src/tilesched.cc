@@ -0,0 +1,123 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <thread>
+#include "tilesched.h"
+
+TileScheduler::TileScheduler(int num_threads) {
+	if (num_threads < 1) {
+		num_threads = 1;
+	}
+	this->num_threads = num_threads;
+	queues = new TileQueue[num_threads];
+	func = 0;
+	cls = 0;
+}
+
+TileScheduler::~TileScheduler() {
+	delete [] queues;
+}
+
+int TileScheduler::get_num_threads() const {
+	return num_threads;
+}
+
+bool TileScheduler::pop_tile(int thread, Tile *tile) {
+	TileQueue *q = queues + thread;
+	std::lock_guard<std::mutex> guard(q->lock);
+
+	if (q->tiles.empty()) {
+		return false;
+	}
+	*tile = q->tiles.front();
+	q->tiles.pop_front();
+	return true;
+}
+
+bool TileScheduler::steal_tile(int thread, Tile *tile) {
+	for (int i = 1; i < num_threads; i++) {
+		TileQueue *q = queues + (thread + i) % num_threads;
+		std::lock_guard<std::mutex> guard(q->lock);
+
+		if (!q->tiles.empty()) {
+			*tile = q->tiles.back();
+			q->tiles.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+void TileScheduler::worker(int thread) {
+	Tile tile;
+
+	// tiles never spawn more work, so once stealing fails we are done
+	while (pop_tile(thread, &tile) || steal_tile(thread, &tile)) {
+		func(tile, thread, cls);
+	}
+}
+
+void TileScheduler::run(const std::vector<Tile> &tiles, TileFunc func, void *cls) {
+	this->func = func;
+	this->cls = cls;
+
+	/* hand out contiguous runs of tiles, so that every thread starts on
+	 * its own part of the image and only steals when it's done with it
+	 */
+	int ntiles = (int)tiles.size();
+	for (int i = 0; i < num_threads; i++) {
+		int start = (long)ntiles * i / num_threads;
+		int end = (long)ntiles * (i + 1) / num_threads;
+
+		queues[i].tiles.assign(tiles.begin() + start, tiles.begin() + end);
+	}
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < num_threads; i++) {
+		threads.push_back(std::thread(&TileScheduler::worker, this, i));
+	}
+
+	worker(0);
+
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+}
+
+void make_tiles(int width, int height, int tile_size, std::vector<Tile> *tiles) {
+	tiles->clear();
+
+	for (int y = 0; y < height; y += tile_size) {
+		for (int x = 0; x < width; x += tile_size) {
+			Tile tile;
+			tile.x = x;
+			tile.y = y;
+			tile.width = x + tile_size > width ? width - x : tile_size;
+			tile.height = y + tile_size > height ? height - y : tile_size;
+			tiles->push_back(tile);
+		}
+	}
+}
+
+int get_num_cpus() {
+	int ncpus = (int)std::thread::hardware_concurrency();
+	return ncpus > 0 ? ncpus : 1;
+}
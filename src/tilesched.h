@@ -0,0 +1,72 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef TILESCHED_H_
+#define TILESCHED_H_
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+struct Tile {
+	int x, y;
+	int width, height;
+};
+
+typedef void (*TileFunc)(const Tile &tile, int thread, void *cls);
+
+/* work-stealing tile scheduler: every worker thread owns a queue of tiles
+ * and takes work from its front, when it runs dry it steals from the back
+ * of the other queues until there's nothing left anywhere.
+ */
+class TileScheduler {
+private:
+	struct TileQueue {
+		std::mutex lock;
+		std::deque<Tile> tiles;
+	};
+
+	int num_threads;
+	TileQueue *queues;
+	TileFunc func;
+	void *cls;
+
+	bool pop_tile(int thread, Tile *tile);
+	bool steal_tile(int thread, Tile *tile);
+	void worker(int thread);
+
+public:
+	TileScheduler(int num_threads);
+	~TileScheduler();
+
+	int get_num_threads() const;
+
+	/* runs func on every tile and returns when all of them are done,
+	 * the calling thread works as thread 0.
+	 */
+	void run(const std::vector<Tile> &tiles, TileFunc func, void *cls);
+};
+
+void make_tiles(int width, int height, int tile_size, std::vector<Tile> *tiles);
+int get_num_cpus();
+
+#endif
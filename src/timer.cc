@@ -0,0 +1,68 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include "timer.h"
+
+#if defined(unix) || defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <sys/time.h>
+#include <time.h>
+
+unsigned long get_msec() {
+	struct timeval tv;
+	static struct timeval tv0;
+
+	gettimeofday(&tv, 0);
+
+	if(tv0.tv_sec == 0 && tv0.tv_usec == 0) {
+		tv0 = tv;
+		return 0;
+	}
+
+	return (tv.tv_sec - tv0.tv_sec) * 1000 + (tv.tv_usec - tv0.tv_usec) / 1000;
+}
+
+unsigned long long get_nsec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#elif defined(WIN32) || defined(__WIN32__)
+#include <windows.h>
+
+unsigned long get_msec() {
+	return timeGetTime();
+}
+
+unsigned long long get_nsec() {
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+
+	if (!freq.QuadPart) {
+		QueryPerformanceFrequency(&freq);
+	}
+	QueryPerformanceCounter(&count);
+	return (unsigned long long)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+}
+
+#else
+#error "unsupported platform"
+#endif
@@ -22,34 +22,133 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #ifndef VECTOR_H_
 #define VECTOR_H_
 
+#include <math.h>
+#include <stdio.h>
+#include "config.h"
+
 class Matrix4x4;
 
-class Vector3 {
+/* 3d vector of any scalar type. Vector3 is the one with the scalar type of
+ * the build, see scalar_t in config.h. Vectors of the other precision have
+ * to be converted explicitly.
+ */
+template <typename T>
+class Vec3 {
 public:
-	double x,y,z;
-	Vector3();
-	Vector3(double x, double y, double z);
-	void transform(const Matrix4x4 &tm);
-	void printv();
+	typedef T scalar;
+
+	T x,y,z;
+
+	constexpr Vec3() : x(0), y(0), z(0) {}
+	constexpr Vec3(T x, T y, T z) : x(x), y(y), z(z) {}
+
+	template <typename U>
+	constexpr explicit Vec3(const Vec3<U> &v) : x((T)v.x), y((T)v.y), z((T)v.z) {}
+
+	inline void transform(const Matrix4x4 &tm);	// in matrix.h
+	inline void printv() const;
 };
 
-bool operator < (const Vector3 &a, const Vector3 &b);
-bool operator > (const Vector3 &a, const Vector3 &b);
+typedef Vec3<scalar_t> Vector3;
 
-Vector3 operator + (const Vector3 &a, const Vector3 &b);
-Vector3 operator - (const Vector3 &a, const Vector3 &b);
-Vector3 operator - (const Vector3 &a);
-Vector3 operator * (const Vector3 &a, const Vector3 &b);
-Vector3 operator * (const Vector3 &a, double b);
-Vector3 operator * (double b, const Vector3 &a);
-Vector3 operator / (const Vector3 &a, double b);
+/* the scalar arguments below are typename Vec3<T>::scalar, so that only the
+ * vector decides T, and v * 2.0 works on vectors of floats as well.
+ */
+template <typename T>
+constexpr bool operator < (const Vec3<T> &a, const Vec3<T> &b) {
+	return a.x < b.x && a.y < b.y && a.z < b.z;
+}
 
-double length (const Vector3 &a);
-double dot (const Vector3 &a, const Vector3 &b);
-Vector3 cross (const Vector3 &a, const Vector3 &b);
-Vector3 normalize (const Vector3 &a);
+template <typename T>
+constexpr bool operator > (const Vec3<T> &a, const Vec3<T> &b) {
+	return a.x > b.x && a.y > b.y && a.z > b.z;
+}
 
-Vector3 reflect(const Vector3 &v, const Vector3 &n);
+template <typename T>
+constexpr Vec3<T> operator + (const Vec3<T> &a, const Vec3<T> &b) {
+	return Vec3<T>(a.x + b.x, a.y + b.y, a.z + b.z);
+}
 
-#endif
+template <typename T>
+constexpr Vec3<T> operator - (const Vec3<T> &a, const Vec3<T> &b) {
+	return Vec3<T>(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+template <typename T>
+constexpr Vec3<T> operator - (const Vec3<T> &a) {
+	return Vec3<T>(-a.x, -a.y, -a.z);
+}
+
+template <typename T>
+constexpr Vec3<T> operator * (const Vec3<T> &a, const Vec3<T> &b) {
+	return Vec3<T>(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+
+template <typename T>
+constexpr Vec3<T> operator * (const Vec3<T> &a, typename Vec3<T>::scalar b) {
+	return Vec3<T>(a.x*b, a.y*b, a.z*b);
+}
+
+template <typename T>
+constexpr Vec3<T> operator * (typename Vec3<T>::scalar b, const Vec3<T> &a) {
+	return Vec3<T>(a.x*b, a.y*b, a.z*b);
+}
+
+template <typename T>
+constexpr Vec3<T> operator / (const Vec3<T> &a, typename Vec3<T>::scalar b) {
+	return Vec3<T>(a.x / b, a.y / b, a.z / b);
+}
 
+template <typename T>
+constexpr T dot(const Vec3<T> &a, const Vec3<T> &b) {
+	return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
+template <typename T>
+constexpr T length_sq(const Vec3<T> &a) {
+	return a.x*a.x + a.y*a.y + a.z*a.z;
+}
+
+template <typename T>
+inline T length(const Vec3<T> &a) {
+	return sqrt(length_sq(a));
+}
+
+template <typename T>
+constexpr Vec3<T> cross(const Vec3<T> &a, const Vec3<T> &b) {
+	return Vec3<T>(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x);
+}
+
+template <typename T>
+inline Vec3<T> normalize(const Vec3<T> &vec) {
+	return vec / length(vec);
+}
+
+// component-wise reciprocal, 1/x etc, for slab tests and the like
+template <typename T>
+constexpr Vec3<T> recip(const Vec3<T> &a) {
+	return Vec3<T>((T)1 / a.x, (T)1 / a.y, (T)1 / a.z);
+}
+
+// component-wise minimum and maximum
+template <typename T>
+constexpr Vec3<T> vmin(const Vec3<T> &a, const Vec3<T> &b) {
+	return Vec3<T>(a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y, a.z < b.z ? a.z : b.z);
+}
+
+template <typename T>
+constexpr Vec3<T> vmax(const Vec3<T> &a, const Vec3<T> &b) {
+	return Vec3<T>(a.x > b.x ? a.x : b.x, a.y > b.y ? a.y : b.y, a.z > b.z ? a.z : b.z);
+}
+
+template <typename T>
+constexpr Vec3<T> reflect(const Vec3<T> &v, const Vec3<T> &n) {
+	return (T)2 * dot(v, n) * n - v;
+}
+
+template <typename T>
+inline void Vec3<T>::printv() const {
+	printf("%f\t%f\t%f\n", (double)x, (double)y, (double)z);
+}
+
+#endif
@@ -0,0 +1,251 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <algorithm>
+#include "wavefront.h"
+#include "bbox.h"
+#include "camera.h"
+#include "config.h"
+#include "light.h"
+#include "object.h"
+#include "shade.h"
+#include "stats.h"
+
+#define PACKET_RAYS	(PACKET_SIZE * PACKET_SIZE)
+
+bool sort_rays = false;
+
+static uint32_t morton3(uint32_t x, uint32_t y, uint32_t z);
+static int octant(const Ray &ray);
+
+void RayQueue::clear() {
+	rays.clear();
+	weight.clear();
+	target.clear();
+}
+
+void RayQueue::push(const Ray &ray, const Color &weight, int target) {
+	rays.push_back(ray);
+	this->weight.push_back(weight);
+	this->target.push_back(target);
+}
+
+int RayQueue::size() const {
+	return (int)rays.size();
+}
+
+void RayQueue::swap(RayQueue &q) {
+	rays.swap(q.rays);
+	weight.swap(q.weight);
+	target.swap(q.target);
+}
+
+const Color *Wavefront::render(int x, int y, int w, int h) {
+	accum.assign(w * h, Color(0, 0, 0));
+
+	// primary rays a block at a time, so that every PACKET_RAYS of them are coherent
+	Ray block[PACKET_RAYS];
+	paths.clear();
+
+	for (int py = 0; py < h; py += PACKET_SIZE) {
+		int yend = py + PACKET_SIZE < h ? py + PACKET_SIZE : h;
+
+		for (int px = 0; px < w; px += PACKET_SIZE) {
+			int xend = px + PACKET_SIZE < w ? px + PACKET_SIZE : w;
+			scene.get_camera()->get_primary_rays(x + px, y + py, xend - px, yend - py, block);
+
+			int i = 0;
+			for (int j = py; j < yend; j++) {
+				for (int k = px; k < xend; k++) {
+					paths.push(block[i++], Color(1, 1, 1), j * w + k);
+				}
+			}
+		}
+	}
+	STAT_ADD(STAT_PRIMARY_RAYS, paths.size());
+
+	for (int depth = MAX_DEPTH; depth > 0 && paths.size(); depth--) {
+		if (sort_rays && depth < MAX_DEPTH) {
+			sort_paths();
+		}
+
+		intersect(depth == MAX_DEPTH);
+		shade_hits(depth);
+		trace_shadows();
+		accumulate();
+
+		paths.swap(next_paths);
+	}
+
+	return accum.data();
+}
+
+/* reorders the paths by the octant of their direction and then along a
+ * morton curve through the bounds of their origins. Only the order in the
+ * queue changes, every path still adds to its own pixel.
+ */
+void Wavefront::sort_paths() {
+	int num = paths.size();
+
+	BBox bounds;
+	bounds.reset();
+	for (int i = 0; i < num; i++) {
+		bounds.include(paths.rays[i].origin);
+	}
+
+	// 10 bits per axis, which leaves the octant above them in the key
+	Vector3 size = bounds.max - bounds.min;
+	double sx = size.x > 0.0 ? 1023.0 / size.x : 0.0;
+	double sy = size.y > 0.0 ? 1023.0 / size.y : 0.0;
+	double sz = size.z > 0.0 ? 1023.0 / size.z : 0.0;
+
+	keys.resize(num);
+	for (int i = 0; i < num; i++) {
+		const Ray &ray = paths.rays[i];
+		uint32_t x = (uint32_t)((ray.origin.x - bounds.min.x) * sx);
+		uint32_t y = (uint32_t)((ray.origin.y - bounds.min.y) * sy);
+		uint32_t z = (uint32_t)((ray.origin.z - bounds.min.z) * sz);
+
+		uint64_t key = (uint64_t)octant(ray) << 30 | morton3(x, y, z);
+		keys[i] = key << 31 | (uint32_t)i;
+	}
+	std::sort(keys.begin(), keys.end());
+
+	next_paths.clear();
+	for (int i = 0; i < num; i++) {
+		int idx = (int)(keys[i] & 0x7fffffff);
+		next_paths.push(paths.rays[idx], paths.weight[idx], paths.target[idx]);
+	}
+	paths.swap(next_paths);
+}
+
+void Wavefront::intersect(bool coherent) {
+	int num = paths.size();
+	inf.resize(num);
+	hit.resize(num);
+
+	if (!coherent) {
+		for (int i = 0; i < num; i++) {
+			hit[i] = scene.intersection(paths.rays[i], &inf[i]);
+		}
+		return;
+	}
+
+	for (int i = 0; i < num; i += PACKET_RAYS) {
+		int count = num - i < PACKET_RAYS ? num - i : PACKET_RAYS;
+		bool packet_hits[PACKET_RAYS];
+
+		scene.intersection(&paths.rays[i], count, &inf[i], packet_hits);
+		for (int j = 0; j < count; j++) {
+			hit[i + j] = packet_hits[j];
+		}
+	}
+}
+
+/* works out the ambient light of every hit and queues up a shadow ray for
+ * every light that can reach it and the reflection of the path, if it's
+ * still worth following.
+ */
+void Wavefront::shade_hits(int depth) {
+	int num = paths.size();
+	local.resize(num);
+	shadows.clear();
+	next_paths.clear();
+
+	int num_lights = (int)scene.lights.size();
+	Color ambient = scene.get_ambient();
+
+	for (int i = 0; i < num; i++) {
+		if (!hit[i]) {
+			continue;
+		}
+		STAT_DEPTH(MAX_DEPTH - depth);
+
+		const Ray &ray = paths.rays[i];
+		Vector3 n = inf[i].normal;
+		Vector3 p = inf[i].i_point;
+		Vector3 v = normalize(ray.origin - p);
+		const Material *mat = scene.get_material(inf[i].object->get_material());
+
+		local[i] = ambient * mat->kd;
+
+		for (int j = 0; j < num_lights; j++) {
+			const Light *light = scene.lights[j];
+
+			Vector3 sorg = secondary_origin(p, n, light->position - p);
+			Ray sray(sorg, light->position - sorg, 0);
+			Color color = light_color(sray.dir, n, v, mat, light);
+
+			// facing away from the light, there's nothing to add either way
+			if (color.x != 0.0 || color.y != 0.0 || color.z != 0.0) {
+				shadows.push(sray, color, i);
+				STAT_INC(STAT_SHADOW_RAYS);
+			}
+		}
+
+		Color weight = paths.weight[i];
+		if (next_bounce(&weight, mat, p, depth)) {
+			Vector3 rdir = reflect(-ray.dir, n);
+			next_paths.push(Ray(secondary_origin(p, n, rdir), rdir, 0), weight, paths.target[i]);
+			STAT_INC(STAT_REFLECTION_RAYS);
+		}
+	}
+}
+
+void Wavefront::trace_shadows() {
+	int num = shadows.size();
+
+	for (int i = 0; i < num; i++) {
+		if (!scene.occluded(shadows.rays[i])) {
+			int idx = shadows.target[i];
+			local[idx] = local[idx] + shadows.weight[i];
+		}
+	}
+}
+
+void Wavefront::accumulate() {
+	int num = paths.size();
+
+	for (int i = 0; i < num; i++) {
+		if (hit[i]) {
+			int pix = paths.target[i];
+			accum[pix] = accum[pix] + paths.weight[i] * local[i];
+		}
+	}
+}
+
+// spreads the low 10 bits of each coordinate 3 apart and interleaves them
+static uint32_t spread_bits(uint32_t x) {
+	x &= 0x3ff;
+	x = (x | (x << 16)) & 0x30000ff;
+	x = (x | (x << 8)) & 0x300f00f;
+	x = (x | (x << 4)) & 0x30c30c3;
+	x = (x | (x << 2)) & 0x9249249;
+	return x;
+}
+
+static uint32_t morton3(uint32_t x, uint32_t y, uint32_t z) {
+	return spread_bits(x) | (spread_bits(y) << 1) | (spread_bits(z) << 2);
+}
+
+static int octant(const Ray &ray) {
+	return ray.sign[0] | (ray.sign[1] << 1) | (ray.sign[2] << 2);
+}
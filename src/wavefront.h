@@ -0,0 +1,85 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef WAVEFRONT_H_
+#define WAVEFRONT_H_
+
+#include <stdint.h>
+#include <vector>
+#include "color.h"
+#include "intinfo.h"
+#include "ray.h"
+
+/* rays waiting for the same kind of work, one array per field, so that
+ * the rays can go to the packet intersection as they are and each kernel
+ * only touches what it needs.
+ */
+struct RayQueue {
+	std::vector<Ray> rays;
+	std::vector<Color> weight;	// of the path, or what the light brings for shadow rays
+	std::vector<int> target;	// pixel of the path, or the hit the shadow ray is for
+
+	void clear();
+	void push(const Ray &ray, const Color &weight, int target);
+	int size() const;
+	void swap(RayQueue &q);
+};
+
+/* sort the reflection rays of every bounce by direction octant and origin
+ * before tracing them (-sortrays), so that rays traced one after the other
+ * go down the same parts of the bvh while they're still in the cache.
+ */
+extern bool sort_rays;
+
+/* breadth-first renderer (-wavefront). Instead of following the path of
+ * every pixel to its end before going on to the next, a whole block of
+ * pixels goes one bounce at a time: all the rays get intersected, the hits
+ * get shaded into a queue of shadow rays and a queue of reflection rays,
+ * the shadow queue gets traced, and what the bounce found gets added to the
+ * pixels. The reflection queue is the next bounce. Each step is one kind
+ * of work over a lot of rays, instead of everything interleaved per pixel.
+ * The colors come out the same as with trace and shade.
+ */
+class Wavefront {
+private:
+	RayQueue paths, next_paths;
+	RayQueue shadows;
+
+	std::vector<IntInfo> inf;
+	std::vector<char> hit;
+	std::vector<Color> local;	// light found at each hit of the bounce
+	std::vector<Color> accum;	// per pixel
+	std::vector<uint64_t> keys;	// sort key << 31 | index in paths
+
+	void sort_paths();
+	void intersect(bool coherent);
+	void shade_hits(int depth);
+	void trace_shadows();
+	void accumulate();
+
+public:
+	/* renders the w x h block of pixels at x, y. Returns the colors in
+	 * scanline order, which stay around until the next call.
+	 */
+	const Color *render(int x, int y, int w, int h);
+};
+
+#endif